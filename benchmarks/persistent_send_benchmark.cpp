@@ -0,0 +1,66 @@
+// Compares flushing with fresh MPI_Isend calls against persistent send requests.
+//
+// Every rank streams small messages to its two ring neighbours, as an iterative stencil or graph kernel with a stable
+// neighbourhood would. The local threshold is small, so there are many flushes of equally sized buffers, which the
+// persistent mode starts from cached requests (MPI_Send_init/MPI_Start).
+//
+// usage: mpirun -np <p> persistent_send_benchmark [messages per rank] [local threshold in bytes]
+
+#include <mpi.h>
+
+#include <cstddef>
+#include <cstdlib>
+#include <iostream>
+#include <utility>
+
+#include "briefkasten/buffered_queue.hpp"
+#include "briefkasten/queue_builder.hpp"
+
+namespace {
+constexpr std::size_t DEFAULT_NUM_MESSAGES = 10'000'000;
+constexpr std::size_t DEFAULT_LOCAL_THRESHOLD_BYTES = 1024;
+constexpr std::size_t CACHE_CAPACITY = 64;
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    MPI_Init(&argc, &argv);
+    std::size_t num_messages = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : DEFAULT_NUM_MESSAGES;
+    std::size_t local_threshold = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : DEFAULT_LOCAL_THRESHOLD_BYTES;
+    int rank = 0;
+    int size = 0;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+    int left = (rank + size - 1) % size;
+    int right = (rank + 1) % size;
+
+    for (auto [name, cache_capacity] : {std::pair{"isend", std::size_t{0}}, std::pair{"persistent", CACHE_CAPACITY}}) {
+        briefkasten::Config config;
+        config.local_threshold_bytes = local_threshold;
+        config.persistent_send_cache_capacity = cache_capacity;
+        auto queue = briefkasten::BufferedMessageQueueBuilder<int>(config).build();
+        std::size_t num_received = 0;
+        auto on_message = [&](auto envelope) { num_received += envelope.message.size(); };
+
+        MPI_Barrier(MPI_COMM_WORLD);
+        double start = MPI_Wtime();
+        for (std::size_t i = 0; i < num_messages; i++) {
+            queue.post_message_blocking(static_cast<int>(i), i % 2 == 0 ? left : right, on_message);
+        }
+        while (!queue.terminate(on_message)) {
+        }
+        double time = MPI_Wtime() - start;
+
+        double max_time = 0;
+        std::size_t num_overflows = queue.num_overflows();
+        std::size_t total_overflows = 0;
+        MPI_Reduce(&time, &max_time, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+        MPI_Reduce(&num_overflows, &total_overflows, 1, MPI_UINT64_T, MPI_SUM, 0, MPI_COMM_WORLD);
+        if (rank == 0) {
+            std::cout << "mode=" << name << " time=" << max_time << " num_flushes=" << total_overflows << "\n";
+        }
+        // the next queue uses the same tags on the same communicator, so nobody may start it before all ranks are done
+        MPI_Barrier(MPI_COMM_WORLD);
+    }
+    MPI_Finalize();
+    return 0;
+}
@@ -0,0 +1,70 @@
+// Compares receiving small messages via persistent receives against matched probes (MPI_Improbe/MPI_Imrecv), and
+// persistent receives which are restarted before or after their messages are handled (see early_receive_restart).
+//
+// Every rank posts messages to random destinations into a BufferedMessageQueue. The local threshold determines the
+// size of the sent messages, so the benchmark sweeps it to cover small and medium message sizes. Run it with different
+// numbers of ranks to see how both receivers scale with the number of senders.
+//
+// usage: mpirun -np <p> receiver_benchmark [messages per rank]
+
+#include <mpi.h>
+
+#include <cstddef>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+
+#include "briefkasten/buffered_queue.hpp"
+#include "briefkasten/detail/receiver.hpp"
+#include "briefkasten/queue_builder.hpp"
+
+namespace {
+constexpr std::size_t DEFAULT_NUM_MESSAGES = 1'000'000;
+
+template <template <typename> class Receiver>
+void run(char const* name, std::size_t num_messages, std::size_t local_threshold, bool early_restart = false) {
+    int rank = 0;
+    int size = 0;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+    briefkasten::Config config;
+    config.local_threshold_bytes = local_threshold;
+    config.early_receive_restart = early_restart;
+    auto queue = briefkasten::BufferedMessageQueueBuilder<int>(config).with_receiver<Receiver>().build();
+    std::size_t num_received = 0;
+    auto on_message = [&](auto envelope) { num_received += envelope.message.size(); };
+    std::default_random_engine generator(static_cast<unsigned>(rank));
+    std::uniform_int_distribution<int> destination(0, size - 1);
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    double start = MPI_Wtime();
+    for (std::size_t i = 0; i < num_messages; i++) {
+        queue.post_message_blocking(static_cast<int>(i), destination(generator), on_message);
+    }
+    while (!queue.terminate(on_message)) {
+    }
+    double time = MPI_Wtime() - start;
+
+    double max_time = 0;
+    MPI_Reduce(&time, &max_time, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+    if (rank == 0) {
+        std::cout << "receiver=" << name << " ranks=" << size << " message_bytes=" << local_threshold
+                  << " time=" << max_time << "\n";
+    }
+    // the next queue uses the same tags on the same communicator, so nobody may start it before all ranks are done
+    MPI_Barrier(MPI_COMM_WORLD);
+}
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    MPI_Init(&argc, &argv);
+    std::size_t num_messages = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : DEFAULT_NUM_MESSAGES;
+
+    for (std::size_t local_threshold : {64, 1024, 16 * 1024, 128 * 1024}) {
+        run<briefkasten::PersistentReceiver>("persistent", num_messages, local_threshold);
+        run<briefkasten::PersistentReceiver>("persistent_early_restart", num_messages, local_threshold, true);
+        run<briefkasten::ProbeReceiver>("probe", num_messages, local_threshold);
+    }
+    MPI_Finalize();
+    return 0;
+}
@@ -0,0 +1,136 @@
+// Microbenchmark for acquiring/releasing request slots of internal::RequestPool.
+//
+// All slots are occupied by pending receives on MPI_COMM_SELF. Each iteration completes a random subset of them (by
+// sending to ourselves), retires them via test_some() and re-acquires the same number of slots, just like the sender
+// does after a burst of completions. Reported times are per slot, and acquiring a slot includes posting its receive.
+//
+// The free-slot stack of RequestPool is compared against ScanningRequestPool, the search it replaced: try the last
+// released slot, otherwise scan for a free one.
+//
+// usage: request_pool_benchmark [iterations]
+
+#include <mpi.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdlib>
+#include <iostream>
+#include <numeric>
+#include <optional>
+#include <random>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "briefkasten/detail/request_pool.hpp"
+
+namespace {
+constexpr std::size_t DEFAULT_ITERATIONS = 10'000;
+constexpr std::size_t COMPLETED_FRACTION = 8;  // complete 1/8th of the slots per iteration
+
+/// The slot search of RequestPool before the free-slot stack, as the baseline.
+class ScanningRequestPool {
+public:
+    explicit ScanningRequestPool(std::size_t capacity) : requests_(capacity, MPI_REQUEST_NULL), indices_(capacity) {}
+
+    std::optional<std::pair<int, MPI_Request&>> get_some_inactive_request() {
+        if (last_slot_.has_value() && requests_[*last_slot_] == MPI_REQUEST_NULL) {
+            int slot = *last_slot_;
+            last_slot_.reset();
+            return {{slot, requests_[slot]}};
+        }
+        last_slot_.reset();
+        auto it = std::ranges::find(requests_, MPI_REQUEST_NULL);
+        if (it == requests_.end()) {
+            return std::nullopt;
+        }
+        return {{static_cast<int>(std::distance(requests_.begin(), it)), *it}};
+    }
+
+    std::size_t test_some(auto&& on_complete) {
+        int outcount = 0;
+        MPI_Testsome(static_cast<int>(requests_.size()), requests_.data(), &outcount, indices_.data(),
+                     MPI_STATUSES_IGNORE);
+        if (outcount == MPI_UNDEFINED) {
+            return 0;
+        }
+        std::for_each_n(indices_.begin(), outcount, [&](int index) {
+            last_slot_ = index;
+            on_complete(index);
+        });
+        return static_cast<std::size_t>(outcount);
+    }
+
+private:
+    std::vector<MPI_Request> requests_;
+    std::vector<int> indices_;
+    std::optional<int> last_slot_;
+};
+
+void post_receive(std::vector<int>& receive_buffers, MPI_Request& request, int slot) {
+    MPI_Irecv(&receive_buffers[slot], 1, MPI_INT, 0, slot, MPI_COMM_SELF, &request);
+}
+
+template <typename Pool>
+void run(std::string_view name, std::size_t num_slots, std::size_t iterations) {
+    using clock = std::chrono::steady_clock;
+    std::default_random_engine generator{0};
+    Pool pool(num_slots);
+    std::vector<int> receive_buffers(num_slots);
+    std::vector<MPI_Request*> slot_requests(num_slots);
+    for (std::size_t i = 0; i < num_slots; i++) {
+        auto request = pool.get_some_inactive_request();
+        slot_requests[request->first] = &request->second;
+        post_receive(receive_buffers, request->second, request->first);
+    }
+    std::vector<int> slots(num_slots);
+    std::iota(slots.begin(), slots.end(), 0);
+    std::size_t num_completed = std::max<std::size_t>(1, num_slots / COMPLETED_FRACTION);
+    clock::duration acquire_time{};
+    clock::duration test_time{};
+    for (std::size_t iteration = 0; iteration < iterations; iteration++) {
+        std::shuffle(slots.begin(), slots.end(), generator);
+        for (std::size_t i = 0; i < num_completed; i++) {
+            int payload = slots[i];
+            MPI_Send(&payload, 1, MPI_INT, 0, slots[i], MPI_COMM_SELF);
+        }
+        auto start = clock::now();
+        // the sends are eager, but the receives are not necessarily matched by the first test
+        std::size_t num_retired = 0;
+        while (num_retired < num_completed) {
+            num_retired += pool.test_some([](int /*slot*/) {});
+        }
+        auto tested = clock::now();
+        // the scanning pool only knows a slot is taken once its request is active, so post right away
+        for (std::size_t i = 0; i < num_completed; i++) {
+            auto request = pool.get_some_inactive_request();
+            post_receive(receive_buffers, request->second, request->first);
+        }
+        auto end = clock::now();
+        test_time += tested - start;
+        acquire_time += end - tested;
+    }
+    for (MPI_Request* request : slot_requests) {
+        MPI_Cancel(request);
+        MPI_Wait(request, MPI_STATUS_IGNORE);
+    }
+    auto per_slot = [&](clock::duration duration) {
+        return std::chrono::duration<double, std::nano>(duration).count() /
+               static_cast<double>(iterations * num_completed);
+    };
+    std::cout << "pool=" << name << " num_slots=" << num_slots << " acquire_ns=" << per_slot(acquire_time)
+              << " test_some_ns=" << per_slot(test_time) << "\n";
+}
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    MPI_Init(&argc, &argv);
+    std::size_t iterations = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : DEFAULT_ITERATIONS;
+    for (std::size_t num_slots : {8, 32, 128, 512, 2048, 8192}) {
+        run<briefkasten::internal::RequestPool>("stack", num_slots, iterations);
+        run<ScanningRequestPool>("scan", num_slots, iterations);
+    }
+    MPI_Finalize();
+    return 0;
+}
@@ -0,0 +1,80 @@
+// Compares the send completion strategies under bursty flushes.
+//
+// Every rank posts messages to random destinations into a BufferedMessageQueue using FlushStrategy::global, so each
+// overflow flushes all aggregation buffers at once. The number of buffer stalls (num_buffer_stalls()) counts how often
+// a new aggregation buffer was requested while all of them were still in flight, i.e. how quickly completed sends hand
+// their buffers back.
+//
+// The baseline (testany) retires at most one completed send per poll, as before MPI_Testsome was used.
+//
+// usage: mpirun -np <p> send_completion_benchmark [messages per rank]
+
+#include <mpi.h>
+
+#include <cstddef>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <utility>
+
+#include "briefkasten/buffered_queue.hpp"
+#include "briefkasten/queue_builder.hpp"
+
+namespace {
+constexpr std::size_t DEFAULT_NUM_MESSAGES = 1'000'000;
+constexpr std::size_t GLOBAL_THRESHOLD_BYTES = 64ULL * 1024;
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    MPI_Init(&argc, &argv);
+    std::size_t num_messages = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : DEFAULT_NUM_MESSAGES;
+    int rank = 0;
+    int size = 0;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+    struct Variant {
+        char const* name;
+        briefkasten::CompletionStrategy strategy;
+        bool retire_all;
+    };
+    for (auto [name, strategy, retire_all] : {Variant{"testany", briefkasten::CompletionStrategy::all, false},
+                                              Variant{"active", briefkasten::CompletionStrategy::active, true},
+                                              Variant{"all", briefkasten::CompletionStrategy::all, true},
+                                              Variant{"round_robin", briefkasten::CompletionStrategy::round_robin,
+                                                      true}}) {
+        briefkasten::Config config;
+        config.flush_strategy = briefkasten::FlushStrategy::global;
+        config.global_threshold_bytes = GLOBAL_THRESHOLD_BYTES;
+        config.send_completion_strategy = strategy;
+        config.retire_all_completed_sends = retire_all;
+        auto queue = briefkasten::BufferedMessageQueueBuilder<int>(config).build();
+        std::default_random_engine generator{static_cast<std::default_random_engine::result_type>(rank)};
+        std::uniform_int_distribution<int> destination(0, size - 1);
+        std::size_t num_received = 0;
+        auto on_message = [&](auto envelope) { num_received += envelope.message.size(); };
+
+        MPI_Barrier(MPI_COMM_WORLD);
+        double start = MPI_Wtime();
+        for (std::size_t i = 0; i < num_messages; i++) {
+            queue.post_message_blocking(static_cast<int>(i), destination(generator), on_message);
+        }
+        while (!queue.terminate(on_message)) {
+        }
+        double time = MPI_Wtime() - start;
+
+        double max_time = 0;
+        std::size_t num_buffer_stalls = queue.num_buffer_stalls();
+        std::size_t total_buffer_stalls = 0;
+        MPI_Reduce(&time, &max_time, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+        MPI_Reduce(&num_buffer_stalls, &total_buffer_stalls, 1, MPI_UINT64_T, MPI_SUM, 0, MPI_COMM_WORLD);
+        if (rank == 0) {
+            std::cout << "strategy=" << name << " time=" << max_time << " num_buffer_stalls=" << total_buffer_stalls
+                      << "\n";
+        }
+        // the next queue uses the same tags on the same communicator, so nobody may start it before all ranks are done
+        MPI_Barrier(MPI_COMM_WORLD);
+    }
+    MPI_Finalize();
+    return 0;
+}
@@ -21,6 +21,7 @@
 
 #include <mpi.h>
 #include <algorithm>
+#include <chrono>
 #include <concepts>
 #include <cstddef>
 #include <cstdint>
@@ -44,11 +45,48 @@ enum class FlushStrategy : std::uint8_t { local, global, random, largest };
 
 struct Config {
     size_t num_request_slots = DEFAULT_NUM_REQUEST_SLOTS;
+    /// Bounds for the number of send slots, which adapts to the load at runtime. 0 means num_request_slots, so by
+    /// default the number of slots is fixed. Note that max_num_aggregation_buffers still limits the sends in flight.
+    std::size_t min_num_request_slots = 0;
+    std::size_t max_num_request_slots = 0;
+    /// Bounds for the number of posted receives, which adapts to the load at runtime. 0 means num_request_slots.
+    std::size_t min_num_receive_slots = 0;
+    std::size_t max_num_receive_slots = 0;
     size_t max_num_aggregation_buffers = 2 * DEFAULT_NUM_REQUEST_SLOTS;
     FlushStrategy flush_strategy = FlushStrategy::local;
     size_t global_threshold_bytes = std::numeric_limits<size_t>::max();
     std::size_t local_threshold_bytes = DEFAULT_BUFFER_THRESHOLD;
     std::size_t send_backlog_capacity = 0;
+    std::size_t send_backlog_capacity_per_destination = std::numeric_limits<std::size_t>::max();
+    CompletionStrategy send_completion_strategy = CompletionStrategy::all;
+    /// Retire all completed sends per poll; false retires at most one (see
+    /// MessageQueue::set_retire_all_completed_sends()).
+    bool retire_all_completed_sends = true;
+    /// Number of (aggregation buffer, receiver) pairings sent from persistent requests; 0 disables persistent sends.
+    std::size_t persistent_send_cache_capacity = 0;
+    /// Maximum number of messages in flight to a receiver that it has not handled yet; 0 disables flow control.
+    std::size_t flow_control_credits = 0;
+    /// Join backlogged buffers to the same receiver into a single message (up to the receive buffer size).
+    bool coalesce_send_backlog = false;
+    /// Keep the receives posted while a received buffer is split and handled (see
+    /// MessageQueue::set_receive_buffer_handover()).
+    bool receive_buffer_handover = false;
+    /// Restart completed receives before their buffers are split and handled, at the cost of a second receive buffer
+    /// per slot (see MessageQueue::set_early_receive_restart()).
+    bool early_receive_restart = false;
+    /// Maximum number of bytes retained in recycled buffers for large messages; 0 disables recycling.
+    std::size_t large_message_buffer_pool_bytes = 0;
+    /// Let poll_throttled() scale its skip threshold with the hit rate of recent polls, up to this value (see
+    /// MessageQueue::set_adaptive_poll_throttling()); 0 uses the threshold passed to poll_throttled().
+    std::size_t max_adaptive_poll_skip_threshold = 0;
+    /// How blocking operations wait while polling makes no progress (see WaitStrategy). Loops with a progress hook
+    /// cannot be woken by it, so keep spinning or backing off if the hook drives other queues.
+    WaitStrategy wait_strategy = WaitStrategy::spin;
+    /// How termination is detected (see TerminationDetection); nbx only takes effect in synchronous mode.
+    TerminationDetection termination_detection = TerminationDetection::double_counting;
+    /// Reduce the message counts for termination within each node first (see
+    /// MessageQueue::enable_hierarchical_termination()).
+    bool hierarchical_termination = false;
 };
 
 template <typename MessageType,
@@ -57,7 +95,8 @@ template <typename MessageType,
           MPIBuffer<BufferType> ReceiveBufferContainer = std::vector<BufferType>,
           aggregation::Merger<MessageType, BufferContainer> Merger = aggregation::AppendMerger,
           aggregation::Splitter<MessageType, BufferContainer> Splitter = aggregation::NoSplitter,
-          aggregation::BufferCleaner<BufferContainer> BufferCleaner = aggregation::NoOpCleaner>
+          aggregation::BufferCleaner<BufferContainer> BufferCleaner = aggregation::NoOpCleaner,
+          template <typename> class SmallMessageReceiver = PersistentReceiver>
 class BufferedMessageQueue {
 public:
     using message_type = MessageType;
@@ -81,6 +120,27 @@ public:
           split(std::move(splitter)),
           pre_send_cleanup(std::move(cleaner)),
           flush_strategy_(config_.flush_strategy) {
+        queue_.set_send_completion_strategy(config_.send_completion_strategy);
+        queue_.set_retire_all_completed_sends(config_.retire_all_completed_sends);
+        queue_.set_send_backlog_capacity_per_destination(config_.send_backlog_capacity_per_destination);
+        queue_.set_persistent_send_cache_capacity(config_.persistent_send_cache_capacity);
+        queue_.set_flow_control_credits(config_.flow_control_credits);
+        queue_.set_send_coalescing(config_.coalesce_send_backlog);
+        queue_.set_receive_buffer_handover(config_.receive_buffer_handover);
+        queue_.set_early_receive_restart(config_.early_receive_restart);
+        queue_.set_large_message_buffer_pool_capacity(config_.large_message_buffer_pool_bytes);
+        queue_.set_adaptive_poll_throttling(config_.max_adaptive_poll_skip_threshold);
+        queue_.set_wait_strategy(config_.wait_strategy);
+        queue_.set_termination_detection(config_.termination_detection);
+        if (config_.hierarchical_termination) {
+            queue_.enable_hierarchical_termination();
+        }
+        queue_.set_send_slot_bounds(
+            config_.min_num_request_slots == 0 ? config_.num_request_slots : config_.min_num_request_slots,
+            config_.max_num_request_slots == 0 ? config_.num_request_slots : config_.max_num_request_slots);
+        queue_.set_receive_slot_bounds(
+            config_.min_num_receive_slots == 0 ? config_.num_request_slots : config_.min_num_receive_slots,
+            config_.max_num_receive_slots == 0 ? config_.num_request_slots : config_.max_num_receive_slots);
         reserve_aggregation_buffers(config_.num_request_slots);
     }
 
@@ -119,6 +179,7 @@ public:
                     }
                     poll(on_message);
                     progress_hook();
+                    wait_if_idle(on_message);
                 }
             });
         return ret;
@@ -235,6 +296,22 @@ public:
             poll_skip_threshold);
     }
 
+    /// Poll, but handle at most as many received buffers as \p budget allows (see MessageQueue::poll_for()). Each
+    /// buffer counts as one message, however many messages it is split into.
+    auto poll_for(PollBudget const& budget, MessageHandler<MessageType> auto&& on_message)
+        -> std::optional<std::pair<bool, bool>> {
+        return queue_.poll_for(budget, split_handler(on_message), [&](std::size_t receipt, BufferContainer buffer) {
+            reclaim_aggregation_buffer(receipt, std::move(buffer));
+        });
+    }
+
+    /// Wait according to the wait strategy if the last poll made no progress (see MessageQueue::wait_if_idle()).
+    void wait_if_idle(MessageHandler<MessageType> auto&& on_message) {
+        queue_.wait_if_idle(split_handler(on_message), [&](std::size_t receipt, BufferContainer buffer) {
+            reclaim_aggregation_buffer(receipt, std::move(buffer));
+        });
+    }
+
     /// Note: Message handlers take a MessageEnvelope as single argument. The Envelope
     /// (not necessarily the underlying data) is moved to the handler when
     /// called.
@@ -274,6 +351,21 @@ public:
         return ret;
     }
 
+    /// Advance a termination attempt by one non-blocking step (see MessageQueue::try_terminate_step()). Before each
+    /// counting round, the aggregation buffers are flushed as far as there is send capacity, over as many steps as
+    /// needed.
+    [[nodiscard]] TerminationStep try_terminate_step(MessageHandler<MessageType> auto&& on_message) {
+        return queue_.try_terminate_step(
+            split_handler(on_message),
+            [&](std::size_t receipt, BufferContainer buffer) {
+                reclaim_aggregation_buffer(receipt, std::move(buffer));
+            },
+            [&] {
+                flush_all_buffers();
+                return aggregation_buffers_.empty();
+            });
+    }
+
     [[nodiscard]] internal::MessageCounter message_counts() const {
         return queue_.message_counts();
     }
@@ -295,11 +387,12 @@ public:
             if (should_stop()) {
                 return;
             }
-            while (!queue_.has_send_capacity()) {
+            while (!queue_.has_send_capacity(it->first)) {
                 poll(on_message);  // only block when slots are exhausted; polling frees them as peers receive
                 if (should_stop()) {
                     return;
                 }
+                wait_if_idle(on_message);
             }
             bool flushed = false;
             std::tie(it, flushed) = flush_buffer_impl(it, /*erase=*/true);
@@ -311,6 +404,13 @@ public:
         queue_.reactivate();
     }
 
+    /// Begin a new epoch after termination, keeping the receives and the buffer pool (see
+    /// MessageQueue::begin_epoch()). This is collective.
+    void begin_epoch() {
+        KASSERT(aggregation_buffers_.empty(), "A new epoch can only begin after termination.");
+        queue_.begin_epoch();
+    }
+
     [[nodiscard]] TerminationState termination_state() const {
         return queue_.termination_state();
     }
@@ -398,6 +498,16 @@ public:
         return config_.send_backlog_capacity;
     }
 
+    /// Adjust the per-receiver limit of the underlying send backlog at runtime.
+    void send_backlog_capacity_per_destination(std::size_t new_capacity) {
+        config_.send_backlog_capacity_per_destination = new_capacity;
+        queue_.set_send_backlog_capacity_per_destination(new_capacity);
+    }
+
+    [[nodiscard]] std::size_t send_backlog_capacity_per_destination() const {
+        return config_.send_backlog_capacity_per_destination;
+    }
+
     [[nodiscard]] PEID rank() const {
         return queue_.rank();
     }
@@ -420,10 +530,39 @@ public:
         queue_.synchronous_mode(use_it);
     }
 
+    void termination_detection(TerminationDetection termination_detection) {
+        config_.termination_detection = termination_detection;
+        queue_.set_termination_detection(termination_detection);
+    }
+
+    void wait_strategy(WaitStrategy wait_strategy) {
+        config_.wait_strategy = wait_strategy;
+        queue_.set_wait_strategy(wait_strategy);
+    }
+
+    /// @return the time blocking operations have spent waiting for progress (see MessageQueue::wait_time())
+    [[nodiscard]] std::chrono::steady_clock::duration wait_time() const {
+        return queue_.wait_time();
+    }
+
+    /// @return the number of times the blocking wait strategy has blocked in MPI (see
+    /// MessageQueue::num_blocking_waits())
+    [[nodiscard]] std::size_t num_blocking_waits() const {
+        return queue_.num_blocking_waits();
+    }
+
     auto num_allocated_buffers() {
         return num_aggregation_buffers_;
     }
 
+    [[nodiscard]] std::size_t num_send_slots() const {
+        return queue_.num_send_slots();
+    }
+
+    [[nodiscard]] std::size_t num_receive_slots() const {
+        return queue_.num_receive_slots();
+    }
+
     [[nodiscard]] std::size_t num_overflows() const {
         return num_overflows_;
     }
@@ -531,8 +670,12 @@ private:
             overflow = true;
             num_overflows_++;
             handle_overflow(it);  // customization point
-            buffer = get_new_buffer();
-            old_buffer_size = buffer.size();  // fresh buffer; flush already adjusted global_buffer_size_
+            // largest-first flushing may have sent another buffer; only a flushed buffer is replaced, otherwise we
+            // would drop its messages
+            if (buffer.empty()) {
+                buffer = get_new_buffer();
+            }
+            old_buffer_size = buffer.size();  // flush already adjusted global_buffer_size_
         }
         merge(buffer, receiver, queue_.rank(), std::move(envelope));
         auto new_buffer_size = buffer.size();
@@ -564,7 +707,7 @@ private:
             }
             return {++buffer_it, true};
         }
-        if (!queue_.has_send_capacity()) {
+        if (!queue_.has_send_capacity(receiver)) {
             return {buffer_it, false};
         }
         num_elements_flushed_ += buffer_it->second.size();
@@ -628,8 +771,19 @@ private:
 
     auto split_handler(MessageHandler<MessageType> auto&& on_message) {
         return [&](Envelope<BufferType> auto buffer) {
-            for (Envelope<MessageType> auto env : split(buffer.message, buffer.sender, queue_.rank())) {
-                on_message(std::move(env));
+            using Batch = decltype(split(buffer.message, buffer.sender, queue_.rank()));
+            if constexpr (BatchMessageHandler<std::remove_reference_t<decltype(on_message)>, Batch>) {
+                on_message.on_batch(split(buffer.message, buffer.sender, queue_.rank()));
+            } else {
+                for (Envelope<MessageType> auto env : split(buffer.message, buffer.sender, queue_.rank())) {
+                    on_message(std::move(env));
+                }
+            }
+            if constexpr (std::same_as<decltype(buffer.message), ReceiveBufferContainer> ||
+                          std::same_as<decltype(buffer.message), HandedOverBuffer<ReceiveBufferContainer>>) {
+                if (config_.receive_buffer_handover || config_.large_message_buffer_pool_bytes > 0) {
+                    queue_.recycle_receive_buffer(std::move(buffer.message));
+                }
             }
         };
     }
@@ -647,7 +801,13 @@ private:
                 return ret.second;
             }
             case FlushStrategy::global: {
-                return flush_all_aggregation_buffers_impl(current_buffer, [] {}, [] { return false; });
+                // the overflowing buffer goes first, so running out of send slots cannot leave it behind
+                if (current_buffer != aggregation_buffers_.end() &&
+                    !flush_buffer_impl(current_buffer, /*erase=*/false).second) {
+                    return false;
+                }
+                std::ignore = flush_all_aggregation_buffers_impl(current_buffer, [] {}, [] { return false; });
+                return true;
             }
             case FlushStrategy::random: {
                 throw std::runtime_error("Random flush strategy not implemented");
@@ -666,17 +826,14 @@ private:
                                    std::invocable<> auto&& progress_hook) {
         while (true) {
             auto res = poll(std::forward<decltype(on_message)>(on_message));
-            if (res && res->first) {  // finished some send
-                break;
+            // once some send finished, try to actually resolve the overflow. With flow control, this may still fail
+            // until the receiver has returned credits, so we keep polling.
+            if (res && res->first && resolve_overflow(current_buffer)) {
+                return;
             }
             progress_hook();
+            wait_if_idle(on_message);
         }
-        // now actually resolve the overflow
-        bool success = resolve_overflow(current_buffer);
-        if (success) {
-            return;
-        }
-        throw std::runtime_error("Failed to resolve overflow in post_message_blocking. This should not happen.");
     }
     void resolve_overflow_blocking(MessageHandler<MessageType> auto&& on_message,
                                    std::invocable<> auto&& progress_hook) {
@@ -705,7 +862,7 @@ private:
     }
 
     Config config_;
-    MessageQueue<BufferType, BufferContainer, ReceiveBufferContainer> queue_;
+    MessageQueue<BufferType, BufferContainer, ReceiveBufferContainer, SmallMessageReceiver> queue_;
     BufferMap aggregation_buffers_;
     BufferList free_aggregation_buffers_;
     size_t local_threshold_bytes_;
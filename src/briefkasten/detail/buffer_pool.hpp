@@ -0,0 +1,117 @@
+// Copyright (c) 2021-2025 Tim Niklas Uhl
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of
+// this software and associated documentation files (the "Software"), to deal in
+// the Software without restriction, including without limitation the rights to
+// use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+// the Software, and to permit persons to whom the Software is furnished to do so,
+// subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+// FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+// COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+// IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#pragma once
+
+#include <bit>
+#include <cstddef>
+#include <ranges>
+#include <utility>
+#include <vector>
+
+#include "./concepts.hpp"
+
+namespace briefkasten::internal {
+
+/// Recycles receive buffers in power-of-two size classes: a buffer with capacity of at least 2^k elements serves all
+/// messages of up to 2^k elements. If the matching size class is empty, a buffer of the next larger non-empty class is
+/// used. The pool retains at most a configurable number of bytes, 0 disables recycling.
+template <MPIBuffer ReceiveBufferContainer>
+class BufferPool {
+public:
+    using value_type = std::ranges::range_value_t<ReceiveBufferContainer>;
+
+    /// Retain at most \p max_retained_bytes in recycled buffers. 0 disables recycling.
+    void set_capacity(std::size_t max_retained_bytes) {
+        capacity_ = max_retained_bytes;
+        for (auto& size_class : size_classes_) {
+            while (retained_bytes_ > capacity_ && !size_class.empty()) {
+                retained_bytes_ -= buffer_bytes(size_class.back());
+                size_class.pop_back();
+            }
+        }
+    }
+
+    /// @return a buffer of \p count elements, recycled if possible
+    ReceiveBufferContainer acquire(std::size_t count) {
+        // the smallest size class whose buffers are large enough, or else the next larger one which has some
+        std::size_t size_class = count == 0 ? 0 : std::bit_width(count - 1);
+        while (size_class < size_classes_.size() && size_classes_[size_class].empty()) {
+            size_class++;
+        }
+        ReceiveBufferContainer buffer;
+        if (size_class < size_classes_.size()) {
+            buffer = std::move(size_classes_[size_class].back());
+            size_classes_[size_class].pop_back();
+            retained_bytes_ -= buffer_bytes(buffer);
+            num_reused_buffers_++;
+        } else if (capacity_ > 0) {
+            // round up, so the buffer can be recycled for its size class
+            if constexpr (requires { buffer.reserve(count); }) {
+                buffer.reserve(std::bit_ceil(count));
+            }
+        }
+        buffer.resize(count);
+        return buffer;
+    }
+
+    /// Keep \p buffer for reuse, unless it has no capacity or the pool is full.
+    void recycle(ReceiveBufferContainer&& buffer) {
+        std::size_t capacity = buffer_capacity(buffer);
+        if (capacity == 0 || retained_bytes_ + buffer_bytes(buffer) > capacity_) {
+            return;
+        }
+        // the buffer serves all messages up to the next smaller power of two
+        std::size_t size_class = std::bit_width(capacity) - 1;
+        if (size_classes_.size() <= size_class) {
+            size_classes_.resize(size_class + 1);
+        }
+        retained_bytes_ += buffer_bytes(buffer);
+        size_classes_[size_class].emplace_back(std::move(buffer));
+    }
+
+    [[nodiscard]] std::size_t retained_bytes() const {
+        return retained_bytes_;
+    }
+
+    /// @return the number of buffers which have been handed out again
+    [[nodiscard]] std::size_t num_reused_buffers() const {
+        return num_reused_buffers_;
+    }
+
+private:
+    static std::size_t buffer_capacity(ReceiveBufferContainer const& buffer) {
+        if constexpr (requires { buffer.capacity(); }) {
+            return buffer.capacity();
+        } else {
+            return buffer.size();
+        }
+    }
+
+    static std::size_t buffer_bytes(ReceiveBufferContainer const& buffer) {
+        return buffer_capacity(buffer) * sizeof(value_type);
+    }
+
+    std::vector<std::vector<ReceiveBufferContainer>> size_classes_;  // recycled buffers by size class
+    std::size_t capacity_ = 0;
+    std::size_t retained_bytes_ = 0;
+    std::size_t num_reused_buffers_ = 0;
+};
+
+}  // namespace briefkasten::internal
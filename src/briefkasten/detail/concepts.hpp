@@ -22,6 +22,7 @@
 #include <concepts>  // IWYU pragma: keep
 #include <kamping/mpi_datatype.hpp>
 #include <ranges>
+#include <utility>
 #include <vector>
 #include "./definitions.hpp"
 
@@ -89,6 +90,26 @@ concept MessageHandler = MessageRange<MessageContainerType, MessageDataType> &&
                              { on_message(std::move(envelope)) };
                          };
 
+/// Wraps a handler which takes all messages split from one received buffer at once, as a forward range of envelopes,
+/// so that it can process them as a batch, e.g. vectorized or prefetching the data they refer to. Where messages are
+/// handled one by one, each of them is passed as a batch of one. Any other handler with a member \c on_batch taking
+/// such a range is treated the same (see BatchMessageHandler).
+template <typename BatchFunc>
+struct BatchHandler {
+    void operator()(auto envelope) {
+        on_batch(std::ranges::single_view{std::move(envelope)});
+    }
+    BatchFunc on_batch;
+};
+
+template <typename BatchFunc>
+BatchHandler(BatchFunc) -> BatchHandler<BatchFunc>;
+
+/// A handler taking a \p Batch of envelopes at once, detected by calling its \c on_batch rather than by its type, so
+/// that handlers deriving from or forwarding to a BatchHandler get batches, too.
+template <typename Func, typename Batch>
+concept BatchMessageHandler = requires(Func& on_message, Batch batch) { on_message.on_batch(std::move(batch)); };
+
 template <typename Func, typename MessageContainerType>
 concept SendFinishedCallback =
     std::invocable<Func, std::size_t> || std::invocable<Func, std::size_t, MessageContainerType>;
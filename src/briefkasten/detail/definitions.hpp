@@ -19,6 +19,21 @@
 
 #pragma once
 
+#include <mpi.h>
+
 namespace briefkasten {
 using PEID = int;
+
+/// @return true if the MPI library we run with supports partitioned communication (MPI_Psend_init/MPI_Pready), which
+/// is part of MPI 4. The library may be older than the headers we were compiled with, so this is checked at runtime.
+inline bool partitioned_communication_available() {
+#if MPI_VERSION >= 4
+    int version = 0;
+    int subversion = 0;
+    MPI_Get_version(&version, &subversion);
+    return version >= 4;
+#else
+    return false;
+#endif
 }
+}  // namespace briefkasten
@@ -21,29 +21,64 @@
 
 #include <mpi.h>
 #include <algorithm>
+#include <chrono>
 #include <concepts>
 #include <cstddef>
 #include <kamping/environment.hpp>
 #include <kamping/mpi_datatype.hpp>
 #include <kassert/kassert.hpp>
+#include <limits>
 #include <optional>
+#include <span>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
 #include "./concepts.hpp"
 #include "./receiver.hpp"
+#include "./rma_rendezvous.hpp"
 #include "./sender.hpp"
 #include "./termination_counter.hpp"
 
 namespace briefkasten {
 
 static constexpr std::size_t DEFAULT_POLL_SKIP_THRESHOLD = 100;
+static constexpr std::size_t NUM_CONTROL_RECEIVE_SLOTS = 4;
+static constexpr std::size_t POLL_THROTTLING_WINDOW = 16;
+static constexpr std::size_t WAIT_SPIN_LIMIT = 64;
+static constexpr std::chrono::microseconds MIN_WAIT_BACKOFF{1};
+static constexpr std::chrono::microseconds MAX_WAIT_BACKOFF{1000};
+
+/// Bounds the work of a single MessageQueue::poll_for() call. The call ends as soon as either limit is reached.
+struct PollBudget {
+    /// Maximum number of received messages passed to the handler.
+    std::size_t max_messages = std::numeric_limits<std::size_t>::max();
+    /// Maximum time spent receiving messages, which is checked between two messages.
+    std::chrono::steady_clock::duration max_duration = std::chrono::steady_clock::duration::max();
+};
 
 enum class TerminationState : std::uint8_t { active, trying_termination, terminated };
 
+/// The outcome of a step of a termination attempt (see MessageQueue::try_terminate_step()).
+enum class TerminationStep : std::uint8_t { in_progress, reactivated, terminated };
+
+/// How blocking operations (e.g. MessageQueue::terminate() or BufferedMessageQueue::post_message_blocking()) wait
+/// while polling makes no progress. After WAIT_SPIN_LIMIT idle polls, they yield the core between polls
+/// (spin_then_yield), sleep for exponentially growing intervals between them (backoff), or block in MPI_Waitsome on
+/// the posted receives, the sends and the termination reduction (blocking). spin keeps polling.
+///
+/// MPI cannot wake us for messages which are received by probing, so blocking backs off instead if large messages,
+/// the RMA rendezvous or partitioned communication are enabled, the receive buffers have been resized, or the small
+/// message receiver has no posted receives.
+enum class WaitStrategy : std::uint8_t { spin, spin_then_yield, backoff, blocking };
+
 template <MPIType T,
           MPIBuffer<T> MessageContainer = std::vector<T>,
-          MPIBuffer<T> ReceiveBufferContainer = std::vector<T>>
+          MPIBuffer<T> ReceiveBufferContainer = std::vector<T>,
+          template <typename> class SmallMessageReceiver = PersistentReceiver>
 class MessageQueue {
 public:
     MessageQueue(MPI_Comm comm,
@@ -54,9 +89,13 @@ public:
         : comm_(comm),
           termination_(comm),
           sender_(comm, num_request_slots, send_backlog_capacity),
+          control_sender_(comm, num_request_slots, std::numeric_limits<std::size_t>::max()),
           receiver_(comm, SMALL_MESSAGE_TAG, termination_, num_request_slots, reserved_receive_buffer_size),
           large_message_receiver_(comm, LARGE_MESSAGE_TAG, termination_),
-          reserved_receive_buffer_size_(reserved_receive_buffer_size) {
+          partitioned_receiver_(comm, PARTITION_HEADER_TAG, PARTITIONED_MESSAGE_TAG, termination_),
+          resize_fallback_receiver_(comm, RESIZE_FALLBACK_TAG, termination_),
+          reserved_receive_buffer_size_(reserved_receive_buffer_size),
+          initial_receive_buffer_size_(reserved_receive_buffer_size) {
         MPI_Comm_rank(comm_, &rank_);
         MPI_Comm_size(comm_, &size_);
 
@@ -72,19 +111,61 @@ public:
         : comm_(other.comm_),
           SMALL_MESSAGE_TAG(other.SMALL_MESSAGE_TAG),
           LARGE_MESSAGE_TAG(other.LARGE_MESSAGE_TAG),
+          CONTROL_MESSAGE_TAG(other.CONTROL_MESSAGE_TAG),
+          PARTITION_HEADER_TAG(other.PARTITION_HEADER_TAG),
+          PARTITIONED_MESSAGE_TAG(other.PARTITIONED_MESSAGE_TAG),
+          RENDEZVOUS_DESCRIPTOR_TAG(other.RENDEZVOUS_DESCRIPTOR_TAG),
+          RENDEZVOUS_ACKNOWLEDGEMENT_TAG(other.RENDEZVOUS_ACKNOWLEDGEMENT_TAG),
+          RESIZE_FALLBACK_TAG(other.RESIZE_FALLBACK_TAG),
+          BUFFER_SIZE_ANNOUNCEMENT_TAG(other.BUFFER_SIZE_ANNOUNCEMENT_TAG),
           termination_(std::move(other.termination_)),
           sender_(std::move(other.sender_)),
+          control_sender_(std::move(other.control_sender_)),
           receiver_(std::move(other.receiver_)),
           large_message_receiver_(other.large_message_receiver_),
+          control_receiver_(std::move(other.control_receiver_)),
+          partitioned_receiver_(std::move(other.partitioned_receiver_)),
+          rma_rendezvous_(std::move(other.rma_rendezvous_)),
+          resize_fallback_receiver_(std::move(other.resize_fallback_receiver_)),
+          consumed_messages_(std::move(other.consumed_messages_)),
+          peer_receive_buffer_sizes_(std::move(other.peer_receive_buffer_sizes_)),
+          announced_receive_buffer_sizes_(std::move(other.announced_receive_buffer_sizes_)),
+          pending_buffer_size_announcements_(std::move(other.pending_buffer_size_announcements_)),
           reserved_receive_buffer_size_(other.reserved_receive_buffer_size_),
+          initial_receive_buffer_size_(other.initial_receive_buffer_size_),
+          resized_receive_buffers_(other.resized_receive_buffers_),
           rank_(other.rank_),
           size_(other.size_),
           allow_large_messages_(other.allow_large_messages_),
+          partitioned_messages_enabled_(other.partitioned_messages_enabled_),
           termination_state_(other.termination_state_),
+          termination_phase_(other.termination_phase_),
+          counting_round_running_(other.counting_round_running_),
           synchronous_mode_(other.synchronous_mode_),
-          poll_count_(other.poll_count_) {
+          termination_detection_(other.termination_detection_),
+          coalesce_sends_(other.coalesce_sends_),
+          poll_count_(other.poll_count_),
+          max_adaptive_poll_skip_threshold_(other.max_adaptive_poll_skip_threshold_),
+          adaptive_poll_skip_threshold_(other.adaptive_poll_skip_threshold_),
+          num_window_polls_(other.num_window_polls_),
+          num_window_hits_(other.num_window_hits_),
+          wait_strategy_(other.wait_strategy_),
+          last_poll_made_progress_(other.last_poll_made_progress_),
+          num_idle_polls_(other.num_idle_polls_),
+          wait_backoff_(other.wait_backoff_),
+          idle_since_(other.idle_since_),
+          wait_time_(other.wait_time_),
+          num_blocking_waits_(other.num_blocking_waits_) {
         receiver_.rebind_termination_counter(termination_);
         large_message_receiver_.rebind_termination_counter(termination_);
+        partitioned_receiver_.rebind_termination_counter(termination_);
+        resize_fallback_receiver_.rebind_termination_counter(termination_);
+        if (control_receiver_.has_value()) {
+            control_receiver_->rebind_termination_counter(termination_);
+        }
+        if (rma_rendezvous_.has_value()) {
+            rma_rendezvous_->rebind_termination_counter(termination_);
+        }
     }
 
     MessageQueue& operator=(MessageQueue const& other) = delete;
@@ -93,39 +174,137 @@ public:
         comm_ = other.comm_;
         SMALL_MESSAGE_TAG = other.SMALL_MESSAGE_TAG;
         LARGE_MESSAGE_TAG = other.LARGE_MESSAGE_TAG;
+        CONTROL_MESSAGE_TAG = other.CONTROL_MESSAGE_TAG;
+        PARTITION_HEADER_TAG = other.PARTITION_HEADER_TAG;
+        PARTITIONED_MESSAGE_TAG = other.PARTITIONED_MESSAGE_TAG;
+        RENDEZVOUS_DESCRIPTOR_TAG = other.RENDEZVOUS_DESCRIPTOR_TAG;
+        RENDEZVOUS_ACKNOWLEDGEMENT_TAG = other.RENDEZVOUS_ACKNOWLEDGEMENT_TAG;
+        RESIZE_FALLBACK_TAG = other.RESIZE_FALLBACK_TAG;
+        BUFFER_SIZE_ANNOUNCEMENT_TAG = other.BUFFER_SIZE_ANNOUNCEMENT_TAG;
         termination_ = std::move(other.termination_);
         sender_ = std::move(other.sender_);
+        control_sender_ = std::move(other.control_sender_);
         receiver_ = std::move(other.receiver_);
         large_message_receiver_ = std::move(other.large_message_receiver_);
+        control_receiver_ = std::move(other.control_receiver_);
+        partitioned_receiver_ = std::move(other.partitioned_receiver_);
+        rma_rendezvous_ = std::move(other.rma_rendezvous_);
+        resize_fallback_receiver_ = std::move(other.resize_fallback_receiver_);
+        consumed_messages_ = std::move(other.consumed_messages_);
+        peer_receive_buffer_sizes_ = std::move(other.peer_receive_buffer_sizes_);
+        announced_receive_buffer_sizes_ = std::move(other.announced_receive_buffer_sizes_);
+        pending_buffer_size_announcements_ = std::move(other.pending_buffer_size_announcements_);
         reserved_receive_buffer_size_ = other.reserved_receive_buffer_size_;
+        initial_receive_buffer_size_ = other.initial_receive_buffer_size_;
+        resized_receive_buffers_ = other.resized_receive_buffers_;
         rank_ = other.rank_;
         size_ = other.size_;
         allow_large_messages_ = other.allow_large_messages_;
+        partitioned_messages_enabled_ = other.partitioned_messages_enabled_;
         termination_state_ = other.termination_state_;
+        termination_phase_ = other.termination_phase_;
+        counting_round_running_ = other.counting_round_running_;
         synchronous_mode_ = other.synchronous_mode_;
+        termination_detection_ = other.termination_detection_;
+        coalesce_sends_ = other.coalesce_sends_;
         poll_count_ = other.poll_count_;
+        max_adaptive_poll_skip_threshold_ = other.max_adaptive_poll_skip_threshold_;
+        adaptive_poll_skip_threshold_ = other.adaptive_poll_skip_threshold_;
+        num_window_polls_ = other.num_window_polls_;
+        num_window_hits_ = other.num_window_hits_;
+        wait_strategy_ = other.wait_strategy_;
+        last_poll_made_progress_ = other.last_poll_made_progress_;
+        num_idle_polls_ = other.num_idle_polls_;
+        wait_backoff_ = other.wait_backoff_;
+        idle_since_ = other.idle_since_;
+        wait_time_ = other.wait_time_;
+        num_blocking_waits_ = other.num_blocking_waits_;
         receiver_.rebind_termination_counter(termination_);
         large_message_receiver_.rebind_termination_counter(termination_);
+        partitioned_receiver_.rebind_termination_counter(termination_);
+        resize_fallback_receiver_.rebind_termination_counter(termination_);
+        if (control_receiver_.has_value()) {
+            control_receiver_->rebind_termination_counter(termination_);
+        }
+        if (rma_rendezvous_.has_value()) {
+            rma_rendezvous_->rebind_termination_counter(termination_);
+        }
+        return *this;
     }
 
     /// Post a message to the message queue
     /// Posting a message may fail if the message box is full and no send slots are available.
     /// @return an optional containing the request id if the message was successfully posted, otherwise nullopt
     auto post_message(MessageContainer&& message, PEID receiver) -> std::optional<std::size_t> {
-        int tag = SMALL_MESSAGE_TAG;
-        if (message.size() > reserved_receive_buffer_size_) {
-            if (!allow_large_messages_) {
-                throw std::runtime_error{"Large messages not allowed, enable them using allow_large_messages"};
-            }
-            tag = LARGE_MESSAGE_TAG;
+        int tag = message_tag(message.size(), receiver);
+        if (tag == LARGE_MESSAGE_TAG && rma_rendezvous_.has_value()) {
+            return expose_for_pulling(sender_.hold_for_pickup(std::move(message), receiver), receiver);
         }
         std::optional<std::size_t> receipt = sender_.enqueue_for_sending(std::move(message), receiver, tag);
         if (receipt.has_value()) {
             termination_.track_send();
         }
+        track_coalesced_sends();
+        return receipt;
+    }
+
+    /// Post a message without copying it into a \c MessageContainer, e.g. a slice of data the application already
+    /// holds. The memory must stay valid and unmodified until the returned receipt is reported by the
+    /// SendFinishedCallback passed to poll(). A callback taking back the container gets an empty one for borrowed
+    /// messages.
+    /// @return an optional containing the request id if the message was successfully posted, otherwise nullopt
+    auto post_borrowed_message(std::span<const T> message, PEID receiver) -> std::optional<std::size_t> {
+        int tag = message_tag(message.size(), receiver);
+        if (tag == LARGE_MESSAGE_TAG && rma_rendezvous_.has_value()) {
+            return expose_for_pulling(sender_.hold_borrowed_for_pickup(message, receiver), receiver);
+        }
+        std::optional<std::size_t> receipt = sender_.enqueue_borrowed_for_sending(message, receiver, tag);
+        if (receipt.has_value()) {
+            termination_.track_send();
+        }
+        track_coalesced_sends();
         return receipt;
     }
 
+    /// Post a large message which is sent in \p num_partitions equally sized partitions. Each partition is released
+    /// with mark_partition_ready() once it has been filled, so that with MPI 4 partitioned communication the first
+    /// partitions are already transferred while the rest of the buffer is still being filled. Without partitioned
+    /// communication, the message is sent as a whole once all partitions are ready (so messages larger than the
+    /// receive buffers have to be allowed, see allow_large_messages()). The memory must stay valid until the returned
+    /// receipt is reported by the SendFinishedCallback passed to poll(). Partitioned messages have to be enabled
+    /// first, see enable_partitioned_messages().
+    /// @return an optional containing the request id if the message was successfully posted, otherwise nullopt
+    auto post_partitioned_message(std::span<const T> message, PEID receiver, std::size_t num_partitions)
+        -> std::optional<std::size_t> {
+        if (!partitioned_messages_enabled_) {
+            throw std::runtime_error{"Partitioned messages not enabled, enable them using enable_partitioned_messages"};
+        }
+        std::optional<std::size_t> receipt;
+        if (partitioned_messages_in_use()) {
+            receipt =
+                sender_.enqueue_partitioned_for_sending(message, receiver, PARTITIONED_MESSAGE_TAG, num_partitions);
+            if (receipt.has_value()) {
+                // announce the message, so the receiver can post a matching receive
+                control_sender_.enqueue_for_sending(std::vector<std::size_t>{message.size(), num_partitions}, receiver,
+                                                    PARTITION_HEADER_TAG);
+            }
+        } else {
+            receipt = sender_.enqueue_partitioned_for_sending(message, receiver, message_tag(message.size(), receiver),
+                                                              num_partitions);
+        }
+        if (receipt.has_value()) {
+            termination_.track_send();
+        }
+        track_coalesced_sends();
+        return receipt;
+    }
+
+    /// Release \p partition of the partitioned message with the given \p receipt (see post_partitioned_message()).
+    void mark_partition_ready(std::size_t receipt, std::size_t partition) {
+        sender_.mark_partition_ready(receipt, partition);
+        track_coalesced_sends();
+    }
+
     /// For single element messages
     auto post_message(T message, PEID receiver) -> std::optional<std::size_t> {
         MessageContainer message_vector{std::move(message)};
@@ -139,31 +318,136 @@ public:
     auto poll(MessageHandler<T, MessageContainer> auto&& on_message,
               SendFinishedCallback<MessageContainer> auto&& on_finished_sending)
         -> std::optional<std::pair<bool, bool>> {
+        auto handle_message = return_credit_after(on_message);
         bool received_large_message = false;
         if (allow_large_messages_) {
-            received_large_message =
-                large_message_receiver_.probe_for_one_message(std::forward<decltype(on_message)>(on_message));
+            received_large_message = large_message_receiver_.probe_for_one_message(handle_message);
         }
-        bool received_something =
-            receiver_.probe_for_messages(std::forward<decltype(on_message)>(on_message)) || received_large_message;
-        if (received_something) {
-            reactivate();
+        bool received_partitioned_message = partitioned_receiver_.probe_for_messages(handle_message);
+        bool received_pulled_message = false;
+        bool pulled_something = false;
+        if (rma_rendezvous_.has_value()) {
+            // pulled messages bypass flow control
+            received_pulled_message = rma_rendezvous_->probe_for_messages(on_message, acknowledge_pull(),
+                                                                          large_message_receiver_.buffer_pool());
+            pulled_something = rma_rendezvous_->probe_for_acknowledgements(
+                [&](std::size_t receipt) { sender_.release_pickup(receipt, on_finished_sending); });
         }
-        bool send_finished_something =
-            sender_.progress_sending(std::forward<decltype(on_finished_sending)>(on_finished_sending));
-        if (send_finished_something || received_something) {
-            return std::pair{send_finished_something, received_something};
+        bool received_fallback_message = probe_for_resize_fallback_message(handle_message);
+        bool received_something = receiver_.probe_for_messages(handle_message) || received_large_message ||
+                                  received_partitioned_message || received_pulled_message ||
+                                  received_fallback_message;
+        return finish_poll(received_something, pulled_something,
+                           std::forward<decltype(on_finished_sending)>(on_finished_sending));
+    }
+
+    /// Like poll(), but passes at most as many messages to \p on_message as \p budget allows, so that the caller can
+    /// interleave communication and computation predictably. Messages beyond the budget are left to the next call.
+    /// Small messages are received one at a time, so poll() has less overhead if many messages arrive at once.
+    auto poll_for(PollBudget const& budget,
+                  MessageHandler<T, MessageContainer> auto&& on_message,
+                  SendFinishedCallback<MessageContainer> auto&& on_finished_sending)
+        -> std::optional<std::pair<bool, bool>> {
+        bool bounded_duration = budget.max_duration != std::chrono::steady_clock::duration::max();
+        auto deadline = bounded_duration ? std::chrono::steady_clock::now() + budget.max_duration
+                                         : std::chrono::steady_clock::time_point::max();
+        std::size_t num_handled = 0;
+        auto remaining_messages = [&]() -> std::size_t {
+            if (num_handled >= budget.max_messages ||
+                (bounded_duration && std::chrono::steady_clock::now() >= deadline)) {
+                return 0;
+            }
+            return budget.max_messages - num_handled;
+        };
+        auto count_message = [&](auto&& envelope) {
+            num_handled++;
+            on_message(std::forward<decltype(envelope)>(envelope));
+        };
+        auto handle_message = return_credit_after(count_message);
+        bool received_something = false;
+        bool pulled_something = false;
+        if (rma_rendezvous_.has_value()) {
+            pulled_something = rma_rendezvous_->probe_for_acknowledgements(
+                [&](std::size_t receipt) { sender_.release_pickup(receipt, on_finished_sending); });
         }
-        return std::nullopt;
+        // one message per channel and round, so that no channel starves the others
+        while (remaining_messages() > 0) {
+            bool received = receiver_.probe_for_one_message(handle_message);
+            if (allow_large_messages_ && remaining_messages() > 0) {
+                received = large_message_receiver_.probe_for_one_message(handle_message) || received;
+            }
+            if (remaining_messages() > 0) {
+                received = probe_for_resize_fallback_message(handle_message) || received;
+            }
+            if (remaining_messages() > 0) {
+                received = partitioned_receiver_.probe_for_messages(handle_message, 1) || received;
+            }
+            if (rma_rendezvous_.has_value() && remaining_messages() > 0) {
+                received = rma_rendezvous_->probe_for_messages(count_message, acknowledge_pull(),
+                                                               large_message_receiver_.buffer_pool(), 1) || received;
+            }
+            if (!received) {
+                break;
+            }
+            received_something = true;
+        }
+        return finish_poll(received_something, pulled_something,
+                           std::forward<decltype(on_finished_sending)>(on_finished_sending));
+    }
+
+    auto poll_for(PollBudget const& budget, MessageHandler<T, MessageContainer> auto&& on_message)
+        -> std::optional<std::pair<bool, bool>> {
+        return poll_for(budget, std::forward<decltype(on_message)>(on_message), [](std::size_t) {});
+    }
+
+    /// @return true if the message with the given \p receipt has been sent, i.e. its buffer may be reused
+    [[nodiscard]] bool test_receipt(std::size_t receipt) const {
+        return sender_.has_finished(receipt);
+    }
+
+    /// Poll until the message with the given \p receipt has been sent. Incoming messages are handled in the
+    /// meantime, so other ranks waiting for us make progress.
+    void wait_receipt(std::size_t receipt,
+                      MessageHandler<T, MessageContainer> auto&& on_message,
+                      SendFinishedCallback<MessageContainer> auto&& on_finished_sending) {
+        while (!test_receipt(receipt)) {
+            poll(on_message, on_finished_sending);
+            wait_if_idle(on_message, on_finished_sending);
+        }
+    }
+
+    void wait_receipt(std::size_t receipt, MessageHandler<T, MessageContainer> auto&& on_message) {
+        wait_receipt(receipt, std::forward<decltype(on_message)>(on_message), [](std::size_t) {});
+    }
+
+    /// Poll until all messages posted so far have been sent, handling incoming messages in the meantime.
+    void wait_all_receipts(MessageHandler<T, MessageContainer> auto&& on_message,
+                           SendFinishedCallback<MessageContainer> auto&& on_finished_sending) {
+        while (sender_.outstanding_sends() > 0) {
+            poll(on_message, on_finished_sending);
+            wait_if_idle(on_message, on_finished_sending);
+        }
+    }
+
+    void wait_all_receipts(MessageHandler<T, MessageContainer> auto&& on_message) {
+        wait_all_receipts(std::forward<decltype(on_message)>(on_message), [](std::size_t) {});
     }
 
     auto poll_throttled(MessageHandler<T, MessageContainer> auto&& on_message,
                         SendFinishedCallback<MessageContainer> auto&& on_finished_sending,
                         std::size_t poll_skip_threshold = DEFAULT_POLL_SKIP_THRESHOLD)
         -> std::optional<std::pair<bool, bool>> {
+        if (max_adaptive_poll_skip_threshold_ > 0) {
+            poll_skip_threshold = adaptive_poll_skip_threshold_;
+        }
         if (poll_count_++ % poll_skip_threshold == 0) {
-            return poll(std::forward<decltype(on_message)>(on_message),
-                        std::forward<decltype(on_finished_sending)>(on_finished_sending));
+            auto result = poll(std::forward<decltype(on_message)>(on_message),
+                               std::forward<decltype(on_finished_sending)>(on_finished_sending));
+            if (max_adaptive_poll_skip_threshold_ > 0) {
+                // an idle poll reports finished sends as well, so only actual progress counts as a hit
+                adapt_poll_skip_threshold(last_poll_made_progress_);
+            }
+            return result;
         }
         return std::nullopt;
     }
@@ -173,6 +457,89 @@ public:
         return poll_throttled(std::forward<decltype(on_message)>(on_message), [](std::size_t) {}, poll_skip_threshold);
     }
 
+    /// Let poll_throttled() scale its skip threshold between 1 and \p max_poll_skip_threshold with the hit rate of the
+    /// recent polls, i.e. the share of them which received a message or finished a send, instead of using the fixed
+    /// threshold passed to it. 0 disables adaptive throttling.
+    void set_adaptive_poll_throttling(std::size_t max_poll_skip_threshold) {
+        max_adaptive_poll_skip_threshold_ = max_poll_skip_threshold;
+        adaptive_poll_skip_threshold_ = 1;
+        num_window_polls_ = 0;
+        num_window_hits_ = 0;
+    }
+
+    /// @return the skip threshold poll_throttled() currently uses with adaptive throttling
+    [[nodiscard]] std::size_t adaptive_poll_skip_threshold() const {
+        return adaptive_poll_skip_threshold_;
+    }
+
+    /// Select how blocking operations wait while polling makes no progress (see WaitStrategy).
+    void set_wait_strategy(WaitStrategy wait_strategy) {
+        wait_strategy_ = wait_strategy;
+    }
+
+    /// Wait according to the wait strategy if the last poll made no progress. Loops which poll until some progress is
+    /// made call this between their polls.
+    void wait_if_idle(MessageHandler<T, MessageContainer> auto&& on_message,
+                      SendFinishedCallback<MessageContainer> auto&& on_finished_sending) {
+        if (last_poll_made_progress_) {
+            return;
+        }
+        if (!idle_since_.has_value()) {
+            idle_since_ = std::chrono::steady_clock::now();
+        }
+        if (wait_strategy_ == WaitStrategy::spin || ++num_idle_polls_ < WAIT_SPIN_LIMIT) {
+            return;
+        }
+        switch (wait_strategy_) {
+            case WaitStrategy::spin_then_yield:
+                std::this_thread::yield();
+                break;
+            case WaitStrategy::blocking:
+                if constexpr (requires { receiver_.requests(); }) {
+                    // nothing wakes us once the other ranks have begun the epoch our sends are waiting for
+                    if (blocking_wait_possible() && termination_.epoch_started()) {
+                        wait_for_requests(on_message, on_finished_sending);
+                        break;
+                    }
+                }
+                [[fallthrough]];
+            case WaitStrategy::backoff:
+                std::this_thread::sleep_for(wait_backoff_);
+                wait_backoff_ = std::min(2 * wait_backoff_, MAX_WAIT_BACKOFF);
+                break;
+            default:
+                break;
+        }
+    }
+
+    /// @return the time blocking operations have spent waiting for progress, i.e. from the first of a series of idle
+    /// polls to the next poll making progress
+    [[nodiscard]] std::chrono::steady_clock::duration wait_time() const {
+        return wait_time_;
+    }
+
+    /// @return the number of times the blocking wait strategy has blocked in MPI until a request completed
+    [[nodiscard]] std::size_t num_blocking_waits() const {
+        return num_blocking_waits_;
+    }
+
+    /// Begin a new epoch after termination, e.g. the next superstep of a bulk-synchronous algorithm, without
+    /// re-creating the queue: the message counts and the termination state are reset, while the posted receives, the
+    /// buffers and the communicators are kept. Messages posted in the new epoch, and control messages such as returned
+    /// credits, are held back until all ranks have begun it, so that they cannot be received as messages of the
+    /// previous one by a rank which is still leaving terminate(). This is collective.
+    void begin_epoch() {
+        KASSERT(sender_.outstanding_sends() + control_sender_.outstanding_sends() == 0u,
+                "A new epoch can only begin after termination.");
+        termination_.begin_epoch();
+        // control messages are counted as well, e.g. the credits returned for messages of the new epoch
+        sender_.pause_sending();
+        control_sender_.pause_sending();
+        termination_state_ = TerminationState::active;
+        termination_phase_ = TerminationPhase::flushing;
+        note_progress(true);
+    }
+
     void reactivate() {
         if (synchronous_mode_) {
             return;
@@ -199,7 +566,7 @@ public:
             }
             // additional_counts() folds in a sibling queue's send/receive counts so that termination of a multi-hop
             // setup is decided by a single allreduce over the whole system (see IndirectionAdapter).
-            termination_.start_message_counting(additional_counts());
+            start_counting_round(additional_counts());
             // poll at least once, so we don't miss any messages
             // if the the message box is empty upon calling this function
             // we never get to poll if message counting finishes instantly
@@ -210,14 +577,63 @@ public:
                 if (termination_state_ == TerminationState::active) {
                     return false;
                 }
+                wait_if_idle(on_message, on_finished_sending);
             } while (!termination_.message_counting_finished());
-            if (termination_.terminated()) {
-                termination_state_ = TerminationState::terminated;
+            if (finish_counting_round(on_message)) {
                 return true;
             }
         }
     }
 
+    /// Advance a termination attempt by one non-blocking step, so that the caller can do other work in between. A step
+    /// either flushes (see \p flush_step), waits for the outstanding sends, or waits for the counting round, polling
+    /// once each time. Once the attempt is reactivated, the next step starts a new one.
+    ///
+    /// \p flush_step is called before each counting round until it returns true, i.e. until everything the caller
+    /// holds back has been posted.
+    [[nodiscard]] TerminationStep try_terminate_step(MessageHandler<T, MessageContainer> auto&& on_message,
+                                                     SendFinishedCallback<MessageContainer> auto&& on_finished_sending,
+                                                     std::predicate<> auto&& flush_step) {
+        if (termination_state_ == TerminationState::terminated) {
+            return TerminationStep::terminated;
+        }
+        if (termination_state_ == TerminationState::active) {
+            termination_state_ = TerminationState::trying_termination;
+            termination_phase_ = TerminationPhase::flushing;
+        }
+        bool flushed = termination_phase_ != TerminationPhase::flushing || flush_step();
+        poll(on_message, on_finished_sending);
+        if (termination_state_ == TerminationState::active) {
+            return TerminationStep::reactivated;
+        }
+        switch (termination_phase_) {
+            case TerminationPhase::flushing:
+                if (flushed) {
+                    termination_phase_ = TerminationPhase::draining;
+                }
+                break;
+            case TerminationPhase::draining:
+                if (sender_.outstanding_sends() == 0 && control_sender_.outstanding_sends() == 0) {
+                    start_counting_round();
+                    termination_phase_ = TerminationPhase::counting;
+                }
+                break;
+            case TerminationPhase::counting:
+                if (termination_.message_counting_finished()) {
+                    if (finish_counting_round(on_message)) {
+                        return TerminationStep::terminated;
+                    }
+                    termination_phase_ = TerminationPhase::flushing;
+                }
+                break;
+        }
+        return TerminationStep::in_progress;
+    }
+
+    [[nodiscard]] TerminationStep try_terminate_step(MessageHandler<T, MessageContainer> auto&& on_message) {
+        return try_terminate_step(on_message, [](std::size_t) {}, [] { return true; });
+    }
+
     [[nodiscard]] bool terminate(MessageHandler<T, MessageContainer> auto&& on_message,
                                  std::invocable<> auto&& before_next_message_counting_round_hook) {
         return terminate(
@@ -234,21 +650,78 @@ public:
     /// this allows using the queue as a somewhat async sparse-all-to-all
     void synchronous_mode(bool use_it = true) {
         synchronous_mode_ = use_it;
+        sender_.set_synchronous_sends(nbx_termination_requested());
+    }
+
+    /// Select how termination is detected (see TerminationDetection). single_round and nbx only take effect as long as
+    /// no other messages than small and large ones are exchanged, i.e. without flow control, the RMA rendezvous or
+    /// partitioned communication. This has to be decided on all ranks alike. Resizing the receive buffers is not
+    /// collective, so it is refused while single_round or nbx is in effect (see resize_receive_buffers()). nbx also
+    /// requires synchronous mode, in which messages are sent in synchronous mode then.
+    void set_termination_detection(TerminationDetection termination_detection) {
+        KASSERT(!resized_receive_buffers_ || termination_detection == TerminationDetection::double_counting ||
+                    !only_data_messages(),
+                "The receive buffers have been resized, which requires double counting termination detection.");
+        termination_detection_ = termination_detection;
+        sender_.set_synchronous_sends(nbx_termination_requested());
     }
 
     [[nodiscard]] size_t reserved_receive_buffer_size() const {
         return reserved_receive_buffer_size_;
     }
 
+    /// Grow the receive buffers to \p new_size elements. This is not collective, and the receiver keeps receiving
+    /// while its slots grow one after another. Until a receiver has told a sender that its slots have grown, the
+    /// sender sends messages larger than the initial receive buffers (but not larger than its own) separately, to be
+    /// received by a matched probe. Every rank probes for them, whether it has grown its own buffers or not. The
+    /// buffers cannot shrink. The buffer size announcements are control messages, which single_round and nbx
+    /// termination detection cannot wait for, so they have to fall back to double counting on all ranks by
+    /// configuration (see set_termination_detection()) for the buffers to be resized.
     void resize_receive_buffers(std::size_t new_size, MessageHandler<T, MessageContainer> auto&& on_message) {
-        receiver_.resize_buffers(new_size, std::forward<decltype(on_message)>(on_message));
+        KASSERT(new_size >= reserved_receive_buffer_size_, "The receive buffers can only grow.");
+        if (termination_detection_ != TerminationDetection::double_counting && only_data_messages()) {
+            throw std::runtime_error{"Resizing the receive buffers requires double counting termination detection"};
+        }
+        receiver_.resize_buffers(new_size, return_credit_after(on_message));
         reserved_receive_buffer_size_ = new_size;
+        resized_receive_buffers_ = true;
     }
 
     void allow_large_messages(bool allow = true) {
         allow_large_messages_ = allow;
     }
 
+    /// Allow post_partitioned_message(). With partitioned communication, each partitioned message is announced by a
+    /// control message, which every rank has to expect, so this has to be called on all ranks before the first message
+    /// is posted.
+    void enable_partitioned_messages() {
+        partitioned_messages_enabled_ = true;
+    }
+
+    /// Transfer large messages (see allow_large_messages()) by remote memory access: the message is exposed in a
+    /// dynamic window and the receiver pulls it into its own buffer with MPI_Rget, instead of relying on the rendezvous
+    /// protocol of the MPI library. The memory of a posted message stays exposed until the receiver has pulled it, and
+    /// the send finishes only then. Large messages bypass flow control in this mode.
+    ///
+    /// The window is created collectively, so all ranks have to enable this together. Likewise, destroying the queue
+    /// is collective afterwards.
+    void enable_rma_rendezvous() {
+        if (!rma_rendezvous_.has_value()) {
+            rma_rendezvous_.emplace(comm_, RENDEZVOUS_DESCRIPTOR_TAG, RENDEZVOUS_ACKNOWLEDGEMENT_TAG, termination_);
+        }
+    }
+
+    /// @return the number of memory regions exposed for pulling, messages at the same address share one
+    [[nodiscard]] std::size_t num_exposed_regions() const {
+        return rma_rendezvous_.has_value() ? rma_rendezvous_->num_attached_regions() : 0;
+    }
+
+    /// Reduce the message counts for termination within each node first, so that only one rank per node takes part in
+    /// the reduction over all nodes. This is collective, so all ranks have to enable it together.
+    void enable_hierarchical_termination() {
+        termination_.enable_hierarchical_counting();
+    }
+
     [[nodiscard]] PEID rank() const {
         return rank_;
     }
@@ -265,10 +738,159 @@ public:
         return sender_.has_capacity();
     }
 
+    /// @return true if a message to \p receiver would currently be accepted by post_message()
+    [[nodiscard]] bool has_send_capacity(PEID receiver) const {
+        return sender_.has_capacity(receiver);
+    }
+
+    /// @return the number of messages to \p receiver which are backlogged or in flight
+    [[nodiscard]] std::size_t outstanding_sends(PEID receiver) const {
+        return sender_.outstanding_sends(receiver);
+    }
+
     void set_send_backlog_capacity(std::size_t send_backlog_capacity) {
         sender_.set_send_backlog_capacity(send_backlog_capacity);
     }
 
+    /// Limit the number of backlogged messages per receiver, so a single hot receiver cannot fill the whole backlog.
+    void set_send_backlog_capacity_per_destination(std::size_t send_backlog_capacity) {
+        sender_.set_send_backlog_capacity_per_destination(send_backlog_capacity);
+    }
+
+    /// Send recurring (buffer, receiver) pairings from persistent requests, caching at most \p cache_capacity of them.
+    /// 0 disables persistent sends.
+    void set_persistent_send_cache_capacity(std::size_t cache_capacity) {
+        sender_.set_persistent_send_cache_capacity(cache_capacity);
+    }
+
+    /// @return the number of sends which hit the persistent send cache
+    [[nodiscard]] std::size_t num_persistent_sends() const {
+        return sender_.num_persistent_sends();
+    }
+
+    /// Let the number of send slots grow (when all are busy) and shrink (when most stay idle) within the given bounds.
+    void set_send_slot_bounds(std::size_t min_num_send_slots, std::size_t max_num_send_slots) {
+        sender_.set_send_slot_bounds(min_num_send_slots, max_num_send_slots);
+    }
+
+    [[nodiscard]] std::size_t num_send_slots() const {
+        return sender_.num_send_slots();
+    }
+
+    /// Let the number of posted receives grow (when all complete at once) and shrink (when most stay idle) within the
+    /// given bounds.
+    void set_receive_slot_bounds(std::size_t min_num_receive_slots, std::size_t max_num_receive_slots) {
+        receiver_.set_receive_slot_bounds(min_num_receive_slots, max_num_receive_slots);
+    }
+
+    [[nodiscard]] std::size_t num_receive_slots() const {
+        return receiver_.num_receive_slots();
+    }
+
+    /// Pass small messages to the handler as an envelope owning the receive buffer (a \c HandedOverBuffer) instead of
+    /// a span into it. The receive is restarted with a recycled buffer before the handler runs, so the handler may keep
+    /// the message without copying it. Buffers the handler does not take are recycled automatically, taken ones may be
+    /// returned with recycle_receive_buffer() once they are no longer needed.
+    void set_receive_buffer_handover(bool handover = true) {
+        if constexpr (requires { receiver_.set_buffer_handover(handover); }) {
+            receiver_.set_buffer_handover(handover);
+        } else if (handover) {
+            throw std::runtime_error("The small message receiver does not support buffer handover.");
+        }
+    }
+
+    /// Restart completed receives of small messages before handling the messages, using a second receive buffer per
+    /// slot. Only supported by the \c PersistentReceiver.
+    void set_early_receive_restart(bool early_restart = true) {
+        if constexpr (requires { receiver_.set_early_restart(early_restart); }) {
+            receiver_.set_early_restart(early_restart);
+        } else if (early_restart) {
+            throw std::runtime_error("The small message receiver does not support early restart.");
+        }
+    }
+
+    /// @return the number of small message receives which have been restarted before their messages were handled
+    [[nodiscard]] std::size_t num_early_receive_restarts() const {
+        if constexpr (requires { receiver_.num_early_restarts(); }) {
+            return receiver_.num_early_restarts();
+        } else {
+            return 0;
+        }
+    }
+
+    /// Return a buffer taken from a message envelope. Buffers larger than the receive buffers go to the pool for large
+    /// messages (see set_large_message_buffer_pool_capacity()).
+    void recycle_receive_buffer(ReceiveBufferContainer&& buffer) {
+        if (buffer.size() > reserved_receive_buffer_size_) {
+            large_message_receiver_.recycle_buffer(std::move(buffer));
+        } else if constexpr (requires { receiver_.recycle_buffer(std::move(buffer)); }) {
+            receiver_.recycle_buffer(std::move(buffer));
+        }
+    }
+
+    /// Return a buffer taken from a message envelope with buffer handover, which is reposted along with the persistent
+    /// receive it was received with.
+    void recycle_receive_buffer(HandedOverBuffer<ReceiveBufferContainer>&& buffer) {
+        if constexpr (requires { receiver_.recycle_buffer(std::move(buffer)); }) {
+            receiver_.recycle_buffer(std::move(buffer));
+        }
+    }
+
+    /// @return the number of persistent receives which have been created for small messages
+    [[nodiscard]] std::size_t num_receive_inits() const {
+        if constexpr (requires { receiver_.num_receive_inits(); }) {
+            return receiver_.num_receive_inits();
+        } else {
+            return 0;
+        }
+    }
+
+    /// Recycle the buffers of large messages in a pool of power-of-two size classes, which retains at most
+    /// \p max_retained_bytes. 0 disables recycling, so each large message gets a newly allocated buffer.
+    void set_large_message_buffer_pool_capacity(std::size_t max_retained_bytes) {
+        large_message_receiver_.set_buffer_pool_capacity(max_retained_bytes);
+    }
+
+    /// @return the number of bytes currently retained in the pool for large messages
+    [[nodiscard]] std::size_t large_message_buffer_pool_bytes() const {
+        return large_message_receiver_.buffer_pool().retained_bytes();
+    }
+
+    /// @return the number of large messages which have been received into a recycled buffer
+    [[nodiscard]] std::size_t num_reused_large_message_buffers() const {
+        return large_message_receiver_.buffer_pool().num_reused_buffers();
+    }
+
+    /// Enable credit-based flow control: each rank may have at most \p credits messages to a receiver which the
+    /// receiver has not handled yet. This bounds the number of unexpected messages at a receiver to \p credits per
+    /// sender. Consumed credits are returned in batches of half the credits via small control messages. 0 disables
+    /// flow control. Has to be called on all ranks before the first message is posted.
+    void set_flow_control_credits(std::size_t credits) {
+        sender_.set_flow_control_credits(credits);
+        if (credits > 0 && !control_receiver_.has_value()) {
+            control_receiver_.emplace(comm_, CONTROL_MESSAGE_TAG, termination_, NUM_CONTROL_RECEIVE_SLOTS, 1);
+        }
+    }
+
+    /// Coalesce backlogged messages to the same receiver into a single send, as long as the result fits into the
+    /// initial receive buffers, which all receivers have. The receiver gets the concatenation of the messages, so this
+    /// should only be enabled if message boundaries can be recovered from the content, as for the aggregation buffers
+    /// of the BufferedMessageQueue.
+    void set_send_coalescing(bool coalesce = true) {
+        coalesce_sends_ = coalesce;
+        sender_.set_coalescing_limit(coalesce ? initial_receive_buffer_size_ : 0);
+    }
+
+    /// Select which send slots are tested for completion on each poll (see CompletionStrategy).
+    void set_send_completion_strategy(CompletionStrategy completion_strategy) {
+        sender_.set_completion_strategy(completion_strategy);
+    }
+
+    /// Retire all completed sends per poll (the default), or at most one, as MPI_Testany does.
+    void set_retire_all_completed_sends(bool retire_all = true) {
+        sender_.set_retire_all_completed_sends(retire_all);
+    }
+
     [[nodiscard]] TerminationState termination_state() const {
         return termination_state_;
     }
@@ -283,33 +905,408 @@ public:
     }
 
 private:
+    /// What a termination attempt waits for (see try_terminate_step()): the caller to flush, the outstanding sends to
+    /// finish, or the counting round.
+    enum class TerminationPhase : std::uint8_t { flushing, draining, counting };
+
+    /// @return the tag to send a message of \p message_size elements to \p receiver with, depending on whether it
+    /// fits into the receive buffers of \p receiver, as far as we know them
+    [[nodiscard]] int message_tag(std::size_t message_size, PEID receiver) const {
+        if (message_size <= initial_receive_buffer_size_) {
+            return SMALL_MESSAGE_TAG;
+        }
+        if (auto it = peer_receive_buffer_sizes_.find(receiver);
+            it != peer_receive_buffer_sizes_.end() && message_size <= it->second) {
+            return SMALL_MESSAGE_TAG;
+        }
+        if (message_size <= reserved_receive_buffer_size_) {
+            // the receiver may not have grown its receive buffers yet
+            return RESIZE_FALLBACK_TAG;
+        }
+        if (!allow_large_messages_) {
+            throw std::runtime_error{"Large messages not allowed, enable them using allow_large_messages"};
+        }
+        return LARGE_MESSAGE_TAG;
+    }
+
+    /// Tell the senders of resize fallback messages the current size of our receive buffers, once all slots have it.
+    /// Unlike other control messages, an announcement does not answer a message received in the meantime, so a
+    /// counting round which has already taken our counts would not notice it. It therefore waits until the round has
+    /// been evaluated, and after termination until the next epoch.
+    void announce_receive_buffer_size() {
+        if (pending_buffer_size_announcements_.empty() || receiver_.resize_pending() || counting_round_running_ ||
+            termination_state_ == TerminationState::terminated) {
+            return;
+        }
+        for (PEID sender : pending_buffer_size_announcements_) {
+            std::size_t& announced_size = announced_receive_buffer_sizes_[sender];
+            if (announced_size >= reserved_receive_buffer_size_) {
+                // the announcement is still on its way
+                continue;
+            }
+            announced_size = reserved_receive_buffer_size_;
+            control_sender_.enqueue_for_sending(std::vector<std::size_t>{announced_size}, sender,
+                                                BUFFER_SIZE_ANNOUNCEMENT_TAG);
+            termination_.track_send();
+        }
+        pending_buffer_size_announcements_.clear();
+    }
+
+    /// Receive the receive buffer sizes other ranks announced to us, so that we send them messages up to these sizes
+    /// as small messages.
+    void receive_buffer_size_announcements() {
+        MPI_Message handle = MPI_MESSAGE_NULL;
+        MPI_Status status;
+        int probe_successful = 0;
+        std::size_t announced_size = 0;
+        while (true) {
+            MPI_Improbe(MPI_ANY_SOURCE, BUFFER_SIZE_ANNOUNCEMENT_TAG, comm_, &probe_successful, &handle, &status);
+            if (!probe_successful) {
+                return;
+            }
+            MPI_Mrecv(&announced_size, 1, kamping::mpi_datatype<std::size_t>(), &handle, &status);
+            termination_.track_receive();
+            std::size_t& known_size = peer_receive_buffer_sizes_[status.MPI_SOURCE];
+            known_size = std::max(known_size, announced_size);
+        }
+    }
+
+    /// Announce the held message with the given receipt and payload to \p receiver, who pulls it by itself.
+    auto expose_for_pulling(std::pair<std::size_t, std::span<const T>> held_message, PEID receiver)
+        -> std::optional<std::size_t> {
+        auto [receipt, payload] = held_message;
+        control_sender_.enqueue_for_sending(rma_rendezvous_->expose(payload, receipt), receiver,
+                                            RENDEZVOUS_DESCRIPTOR_TAG);
+        termination_.track_send();
+        return receipt;
+    }
+
+    void track_coalesced_sends() {
+        termination_.track_coalesced_sends(sender_.take_num_coalesced_sends());
+    }
+
+    /// The part of poll() and poll_for() after receiving: handle control messages and progress the sends.
+    auto finish_poll(bool received_something,
+                     bool pulled_something,
+                     SendFinishedCallback<MessageContainer> auto&& on_finished_sending)
+        -> std::optional<std::pair<bool, bool>> {
+        if (received_something) {
+            reactivate();
+        }
+        if (sender_.sending_paused() && termination_.message_counting_finished() && termination_.epoch_started()) {
+            // the single counting round has finished, maybe after terminate() has been left, and all ranks have
+            // begun the current epoch
+            sender_.pause_sending(false);
+        }
+        if (control_sender_.sending_paused() && termination_.epoch_started()) {
+            control_sender_.pause_sending(false);
+        }
+        std::size_t outstanding_sends = sender_.outstanding_sends() + control_sender_.outstanding_sends();
+        bool granted_credits = false;
+        if (control_receiver_.has_value()) {
+            // control messages are counted for termination, but they carry no work, so they do not reactivate us
+            granted_credits = control_receiver_->probe_for_messages(grant_credits());
+        }
+        control_sender_.progress_sending([](std::size_t) {});
+        bool send_finished_something =
+            sender_.progress_sending(std::forward<decltype(on_finished_sending)>(on_finished_sending)) ||
+            pulled_something;
+        track_coalesced_sends();
+        // progress_sending() also reports success if nothing is in flight, so we compare the outstanding sends
+        note_progress(received_something || pulled_something || granted_credits ||
+                      sender_.outstanding_sends() + control_sender_.outstanding_sends() < outstanding_sends);
+        if (send_finished_something || received_something) {
+            return std::pair{send_finished_something, received_something};
+        }
+        return std::nullopt;
+    }
+
+    /// Receive a message sent while our receive buffers grew (see resize_receive_buffers()), and exchange the sizes
+    /// of the receive buffers with the other ranks.
+    bool probe_for_resize_fallback_message(MessageHandler<T, MessageContainer> auto&& handle_message) {
+        // a sender which has grown its buffers may send us fallback messages before we grow ours
+        bool received = resize_fallback_receiver_.probe_for_one_message([&](auto&& envelope) {
+            if (envelope.message.size() <= reserved_receive_buffer_size_) {
+                // the sender does not know yet that it fits into our receive buffers
+                pending_buffer_size_announcements_.insert(envelope.sender);
+            }
+            handle_message(std::forward<decltype(envelope)>(envelope));
+        });
+        announce_receive_buffer_size();
+        receive_buffer_size_announcements();
+        return received;
+    }
+
+    [[nodiscard]] bool nbx_termination_requested() const {
+        return synchronous_mode_ && termination_detection_ == TerminationDetection::nbx;
+    }
+
+    /// Start a counting round with the selected termination detection (see TerminationDetection).
+    void start_counting_round(internal::MessageCounter additional_counts = {.send = 0, .receive = 0}) {
+        counting_round_running_ = true;
+        if (nbx_termination_possible()) {
+            // all our sends are synchronous and finished, i.e. they have been matched
+            termination_.start_barrier();
+        } else if (single_round_termination_possible()) {
+            sender_.pause_sending();
+            termination_.start_single_round_counting();
+        } else {
+            termination_.start_message_counting(additional_counts);
+        }
+    }
+
+    /// Evaluate the finished counting round.
+    /// @return true if all ranks have terminated
+    bool finish_counting_round(MessageHandler<T, MessageContainer> auto&& on_message) {
+        sender_.pause_sending(!termination_.epoch_started());
+        counting_round_running_ = false;
+        if (!termination_.terminated()) {
+            return false;
+        }
+        if (nbx_termination_possible()) {
+            // a synchronous send finishes once its receive has started, so receives matched before the barrier
+            // completed may not have been handed to us yet
+            while (receiver_.probe_for_messages(return_credit_after(on_message))) {
+            }
+        }
+        termination_state_ = TerminationState::terminated;
+        stop_wait_timer();
+        return true;
+    }
+
+    /// @return true if all messages are data messages sent by the sender, i.e. there are no control messages. This only
+    /// depends on the configuration all ranks share, so that all of them choose the same collectives for termination
+    /// detection.
+    [[nodiscard]] bool only_data_messages() const {
+        return !control_receiver_.has_value() && !rma_rendezvous_.has_value() && !partitioned_messages_in_use();
+    }
+
+    /// @return true if all messages are sent in synchronous mode, so that a rank has finished sending once the sends
+    /// have finished
+    [[nodiscard]] bool nbx_termination_possible() const {
+        return nbx_termination_requested() && only_data_messages();
+    }
+
+    [[nodiscard]] bool single_round_termination_possible() const {
+        return termination_detection_ == TerminationDetection::single_round && only_data_messages();
+    }
+
+    /// @return a handler for control messages returning flow control credits
+    auto grant_credits() {
+        return [&](auto envelope) { sender_.grant_credits(envelope.sender, envelope.message.front()); };
+    }
+
+    void note_progress(bool made_progress) {
+        last_poll_made_progress_ = made_progress;
+        if (made_progress) {
+            num_idle_polls_ = 0;
+            wait_backoff_ = MIN_WAIT_BACKOFF;
+            stop_wait_timer();
+        }
+    }
+
+    void stop_wait_timer() {
+        if (idle_since_.has_value()) {
+            wait_time_ += std::chrono::steady_clock::now() - *idle_since_;
+            idle_since_.reset();
+        }
+    }
+
+    /// @return true if MPI can wake us for every message we may receive, i.e. all of them are received by the posted
+    /// receives of the small message receiver
+    [[nodiscard]] bool blocking_wait_possible() const {
+        return !allow_large_messages_ && !resized_receive_buffers_ && !rma_rendezvous_.has_value() &&
+               !partitioned_messages_in_use();
+    }
+
+    /// @return true if partitioned messages are sent by partitioned communication, i.e. there are partition headers
+    /// and partitioned receives
+    [[nodiscard]] bool partitioned_messages_in_use() const {
+        return partitioned_messages_enabled_ && partitioned_communication_available();
+    }
+
+    /// Block in MPI_Waitsome until a receive of a small or control message, a send or the termination reduction
+    /// completes, and hand the completed requests to their owners.
+    void wait_for_requests(MessageHandler<T, MessageContainer> auto&& on_message,
+                           SendFinishedCallback<MessageContainer> auto&& on_finished_sending) {
+        // waiting completes copies of the requests on behalf of their owners; the handlers may wait again, so nothing
+        // here may be reused across calls
+        std::vector<MPI_Request> requests;
+        auto append = [&](std::span<MPI_Request const> owned_requests) {
+            requests.insert(requests.end(), owned_requests.begin(), owned_requests.end());
+            return static_cast<int>(owned_requests.size());
+        };
+        int num_receives = append(receiver_.requests());
+        int num_control_receives = control_receiver_.has_value() ? append(control_receiver_->requests()) : 0;
+        int num_sends = append(sender_.send_requests());
+        int num_control_sends = append(control_sender_.send_requests());
+        requests.push_back(termination_.message_counting_request());
+        std::vector<int> indices(requests.size());
+        std::vector<MPI_Status> statuses(requests.size());
+        int num_completed = 0;
+        MPI_Waitsome(static_cast<int>(requests.size()), requests.data(), &num_completed, indices.data(),
+                     statuses.data());
+        if (num_completed == MPI_UNDEFINED) {
+            // there is nothing to wait for
+            std::this_thread::yield();
+            return;
+        }
+        num_blocking_waits_++;
+        std::vector<int> receives;
+        std::vector<MPI_Status> receive_statuses;
+        std::vector<int> control_receives;
+        std::vector<MPI_Status> control_receive_statuses;
+        std::vector<int> sends;
+        std::vector<int> control_sends;
+        for (int i = 0; i < num_completed; i++) {
+            int index = indices[i];
+            if (index < num_receives) {
+                receives.push_back(index);
+                receive_statuses.push_back(statuses[i]);
+            } else if ((index -= num_receives) < num_control_receives) {
+                control_receives.push_back(index);
+                control_receive_statuses.push_back(statuses[i]);
+            } else if ((index -= num_control_receives) < num_sends) {
+                sends.push_back(index);
+            } else if ((index -= num_sends) < num_control_sends) {
+                control_sends.push_back(index);
+            } else {
+                termination_.finish_message_counting();
+            }
+        }
+        // free the slots of the completed sends before the message handlers may poll again
+        control_sender_.handle_completed_sends(control_sends, [](std::size_t) {});
+        sender_.handle_completed_sends(sends, on_finished_sending);
+        bool received_something =
+            receiver_.handle_completed_receives(receives, receive_statuses, return_credit_after(on_message));
+        if (received_something) {
+            reactivate();
+        }
+        if (control_receiver_.has_value()) {
+            control_receiver_->handle_completed_receives(control_receives, control_receive_statuses, grant_credits());
+        }
+        track_coalesced_sends();
+        note_progress(true);
+    }
+
+    /// @return a callback acknowledging a message pulled by the RMA rendezvous to its sender
+    auto acknowledge_pull() {
+        return [&](PEID source, std::size_t receipt) {
+            auto acknowledgement_receipt = control_sender_.enqueue_for_sending(std::vector<std::size_t>{receipt},
+                                                                               source, RENDEZVOUS_ACKNOWLEDGEMENT_TAG);
+            KASSERT(acknowledgement_receipt.has_value(), "The control message backlog is unbounded.");
+        };
+    }
+
+    /// Halve the skip threshold if most of the recent polls hit, double it if few of them did.
+    void adapt_poll_skip_threshold(bool hit) {
+        num_window_hits_ += hit ? 1 : 0;
+        if (++num_window_polls_ < POLL_THROTTLING_WINDOW) {
+            return;
+        }
+        std::size_t previous_threshold = adaptive_poll_skip_threshold_;
+        if (2 * num_window_hits_ >= num_window_polls_) {
+            adaptive_poll_skip_threshold_ = std::max<std::size_t>(1, adaptive_poll_skip_threshold_ / 2);
+        } else if (8 * num_window_hits_ < num_window_polls_) {
+            adaptive_poll_skip_threshold_ =
+                std::min(max_adaptive_poll_skip_threshold_, 2 * adaptive_poll_skip_threshold_);
+        }
+        if (adaptive_poll_skip_threshold_ != previous_threshold) {
+            // skip a full interval of the new threshold before the next poll
+            poll_count_ = 1;
+        }
+        num_window_polls_ = 0;
+        num_window_hits_ = 0;
+    }
+
+    /// Wrap \p on_message, so that each handled message returns its credit to the sender.
+    auto return_credit_after(MessageHandler<T, MessageContainer> auto&& on_message) {
+        // the envelope is only forwarded, so a receive buffer the handler does not take stays with the receiver
+        return [&](auto&& envelope) {
+            PEID source = envelope.sender;
+            on_message(std::forward<decltype(envelope)>(envelope));
+            if (sender_.flow_control_credits() > 0) {
+                return_credit(source);
+            }
+        };
+    }
+
+    void return_credit(PEID source) {
+        std::size_t& consumed = consumed_messages_[source];
+        consumed++;
+        // return credits in batches, but early enough that the sender is never left without any
+        if (consumed >= std::max<std::size_t>(1, sender_.flow_control_credits() / 2)) {
+            auto receipt = control_sender_.enqueue_for_sending(std::vector<std::size_t>{consumed}, source,
+                                                               CONTROL_MESSAGE_TAG);
+            KASSERT(receipt.has_value(), "The control message backlog is unbounded.");
+            termination_.track_send();
+            consumed_messages_.erase(source);
+        }
+    }
+
     void poll_until_no_outstanding_sends(
         MessageHandler<T, MessageContainer> auto&& on_message,
         SendFinishedCallback<MessageContainer> auto&& on_finished_sending,
         std::predicate<> auto&& should_stop_polling = [] { return false; }) {
-        while (sender_.outstanding_sends() > 0) {
-            poll(std::forward<decltype(on_message)>(on_message),
-                 std::forward<decltype(on_finished_sending)>(on_finished_sending));
+        while (sender_.outstanding_sends() > 0 || control_sender_.outstanding_sends() > 0) {
+            poll(on_message, on_finished_sending);
             if (should_stop_polling()) {
                 return;
             }
+            wait_if_idle(on_message, on_finished_sending);
         }
     }
 
     MPI_Comm comm_;
     int SMALL_MESSAGE_TAG = kamping::Environment<>::tag_upper_bound() - 1;
     int LARGE_MESSAGE_TAG = kamping::Environment<>::tag_upper_bound() - 2;
+    int CONTROL_MESSAGE_TAG = kamping::Environment<>::tag_upper_bound() - 3;
+    int PARTITION_HEADER_TAG = kamping::Environment<>::tag_upper_bound() - 4;
+    int PARTITIONED_MESSAGE_TAG = kamping::Environment<>::tag_upper_bound() - 5;
+    int RENDEZVOUS_DESCRIPTOR_TAG = kamping::Environment<>::tag_upper_bound() - 6;
+    int RENDEZVOUS_ACKNOWLEDGEMENT_TAG = kamping::Environment<>::tag_upper_bound() - 7;
+    int RESIZE_FALLBACK_TAG = kamping::Environment<>::tag_upper_bound() - 8;
+    int BUFFER_SIZE_ANNOUNCEMENT_TAG = kamping::Environment<>::tag_upper_bound() - 9;
     internal::TerminationCounter termination_;
     Sender<MessageContainer> sender_;
-    PersistentReceiver<ReceiveBufferContainer> receiver_;
+    // returns flow control credits, announces partitioned messages and receive buffer sizes
+    Sender<std::vector<std::size_t>> control_sender_;
+    SmallMessageReceiver<ReceiveBufferContainer> receiver_;
     AllocatingProbeReceiver<ReceiveBufferContainer> large_message_receiver_;
+    std::optional<PersistentReceiver<std::vector<std::size_t>>> control_receiver_;
+    PartitionedReceiver<ReceiveBufferContainer> partitioned_receiver_;
+    std::optional<internal::RmaRendezvous<ReceiveBufferContainer>> rma_rendezvous_;
+    // messages which may not fit into the receiver's buffers yet while they grow (see resize_receive_buffers())
+    AllocatingProbeReceiver<ReceiveBufferContainer> resize_fallback_receiver_;
+    std::unordered_map<PEID, std::size_t> consumed_messages_;  // per sender, not yet returned as credits
+    std::unordered_map<PEID, std::size_t> peer_receive_buffer_sizes_;       // as announced by the receivers
+    std::unordered_map<PEID, std::size_t> announced_receive_buffer_sizes_;  // per sender
+    std::unordered_set<PEID> pending_buffer_size_announcements_;
     size_t reserved_receive_buffer_size_;
+    size_t initial_receive_buffer_size_;  // all ranks start with it, so every receiver fits messages up to this size
+    bool resized_receive_buffers_ = false;
     PEID rank_ = 0;
     PEID size_ = 0;
     bool allow_large_messages_ = false;
+    bool partitioned_messages_enabled_ = false;
     TerminationState termination_state_ = TerminationState::active;
+    TerminationPhase termination_phase_ = TerminationPhase::flushing;
+    bool counting_round_running_ = false;  // from taking the local counts until the round has been evaluated
     bool synchronous_mode_ = false;
+    TerminationDetection termination_detection_ = TerminationDetection::double_counting;
+    bool coalesce_sends_ = false;
     std::size_t poll_count_ = 0;
+    std::size_t max_adaptive_poll_skip_threshold_ = 0;  // 0 if adaptive throttling is disabled
+    std::size_t adaptive_poll_skip_threshold_ = 1;
+    std::size_t num_window_polls_ = 0;  // polls and hits since the skip threshold was last adapted
+    std::size_t num_window_hits_ = 0;
+    WaitStrategy wait_strategy_ = WaitStrategy::spin;
+    bool last_poll_made_progress_ = true;
+    std::size_t num_idle_polls_ = 0;  // since the last poll making progress
+    std::chrono::microseconds wait_backoff_ = MIN_WAIT_BACKOFF;
+    std::optional<std::chrono::steady_clock::time_point> idle_since_;
+    std::chrono::steady_clock::duration wait_time_{0};
+    std::size_t num_blocking_waits_ = 0;
 };
 
 }  // namespace briefkasten
@@ -19,16 +19,25 @@
 
 #pragma once
 
+#include <algorithm>
+#include <array>
 #include <cstddef>
+#include <deque>
 #include <kamping/environment.hpp>
+#include <limits>
+#include <list>
+#include <memory>
 #include <ranges>
 #include <span>
+#include <utility>
 #include <vector>
 
 #include <mpi.h>
 #include <kamping/mpi_datatype.hpp>
 
+#include "./buffer_pool.hpp"
 #include "./concepts.hpp"
+#include "./definitions.hpp"
 #include "./termination_counter.hpp"
 
 #ifdef BRIEFKASTEN_CXX20
@@ -54,6 +63,122 @@ auto build_envelope(MPIBuffer auto const& buffer, MPI_Status& status, int rank)
 }
 }  // namespace internal
 
+static constexpr std::size_t RECEIVE_SLOT_SHRINK_INTERVAL = 1024;
+
+/// A receive buffer handed over to the message handler (see PersistentReceiver). As a range, it only covers the
+/// received message, but the buffer keeps its full size, so that it can be reposted without resizing once it is
+/// returned with recycle_buffer().
+template <MPIBuffer Container>
+class HandedOverBuffer {
+public:
+    using value_type = std::ranges::range_value_t<Container>;
+
+    HandedOverBuffer() = default;
+
+    HandedOverBuffer(Container buffer, std::size_t message_size)
+        : buffer_(std::move(buffer)),
+          message_size_(message_size) {}
+
+    HandedOverBuffer(HandedOverBuffer const&) = default;
+
+    HandedOverBuffer(HandedOverBuffer&& other) noexcept
+        : buffer_(std::move(other.buffer_)),
+          message_size_(std::exchange(other.message_size_, 0)) {}
+
+    HandedOverBuffer& operator=(HandedOverBuffer const&) = default;
+
+    HandedOverBuffer& operator=(HandedOverBuffer&& other) noexcept {
+        buffer_ = std::move(other.buffer_);
+        message_size_ = std::exchange(other.message_size_, 0);
+        return *this;
+    }
+
+    ~HandedOverBuffer() = default;
+
+    [[nodiscard]] auto begin() {
+        return std::ranges::begin(buffer_);
+    }
+
+    [[nodiscard]] auto begin() const {
+        return std::ranges::begin(buffer_);
+    }
+
+    [[nodiscard]] auto end() {
+        return begin() + static_cast<std::ptrdiff_t>(message_size_);
+    }
+
+    [[nodiscard]] auto end() const {
+        return begin() + static_cast<std::ptrdiff_t>(message_size_);
+    }
+
+    [[nodiscard]] auto data() {
+        return std::ranges::data(buffer_);
+    }
+
+    [[nodiscard]] auto data() const {
+        return std::ranges::data(buffer_);
+    }
+
+    [[nodiscard]] std::size_t size() const {
+        return message_size_;
+    }
+
+    [[nodiscard]] bool empty() const {
+        return message_size_ == 0;
+    }
+
+    [[nodiscard]] auto& front() {
+        return *begin();
+    }
+
+    [[nodiscard]] auto const& front() const {
+        return *begin();
+    }
+
+    [[nodiscard]] auto& operator[](std::size_t index) {
+        return begin()[static_cast<std::ptrdiff_t>(index)];
+    }
+
+    [[nodiscard]] auto const& operator[](std::size_t index) const {
+        return begin()[static_cast<std::ptrdiff_t>(index)];
+    }
+
+    /// @return the whole receive buffer, of which the message is a prefix
+    [[nodiscard]] Container& buffer() {
+        return buffer_;
+    }
+
+    /// Take the message as a container of its own. The buffer is shrunk to the message, so it has to be resized to be
+    /// reposted.
+    [[nodiscard]] Container release() && {
+        buffer_.resize(std::exchange(message_size_, 0));
+        return std::move(buffer_);
+    }
+
+private:
+    Container buffer_;
+    std::size_t message_size_ = 0;
+};
+
+/// Receives messages into a number of persistent receive requests, which are restarted after each message.
+///
+/// The number of receive slots may be elastic: if all slots complete in a single probe, the receiver posts twice as
+/// many, up to an upper bound. If at most a quarter of them has been in use during RECEIVE_SLOT_SHRINK_INTERVAL
+/// probes, it retires half of them again, down to a lower bound.
+///
+/// With buffer handover, the handler gets an envelope owning the receive buffer (a HandedOverBuffer) instead of a span
+/// into it. The slot gets a recycled buffer and is restarted before the handler runs, so it stays posted during long
+/// handlers and the handler may keep the message without copying it. Buffers which the handler leaves in the envelope,
+/// or hands back via recycle_buffer(), are reused. The persistent receive of a handed over buffer is parked until the
+/// buffer comes back, so a recycled buffer is reposted without creating a new one.
+///
+/// Completed receives are restarted together with a single MPI_Startall after their messages have been handled. With
+/// early restart, each slot has a second persistent receive with a buffer of its own instead, which is started before
+/// the message in the first one is handled, so the slot stays posted while the handlers run.
+///
+/// Resizing the buffers does not cancel all receives at once. Instead, each slot gets a buffer of the new size when it
+/// is restarted next, and slots which stay idle are cancelled and reposted one per probe, so that the receiver keeps
+/// receiving throughout. Until resize_pending() turns false, some slots may still receive into buffers of the old size.
 template <MPIBuffer ReceiveBufferContainer>
 class PersistentReceiver {
 public:
@@ -70,36 +195,15 @@ public:
           receive_buffers_(num_receive_slots),
           statuses_(1, std::vector<MPI_Status>(num_receive_slots)),
           indices_(1, std::vector<int>(num_receive_slots)),
-          termination_(&termination_counter) {
+          termination_(&termination_counter),
+          min_num_receive_slots_(num_receive_slots),
+          max_num_receive_slots_(num_receive_slots),
+          buffer_size_(reserved_receive_buffer_size) {
         KASSERT(tag_ < kamping::Environment<>::tag_upper_bound());
         MPI_Comm_rank(comm, &rank_);
-#ifdef BRIEFKASTEN_CXX20
-        namespace views = ranges::views;
-#else
-        namespace views = std::views;
-#endif
-        for (auto [request, buffer] : views::zip(receive_requests_, receive_buffers_)) {
-            buffer.resize(reserved_receive_buffer_size);
-#if MPI_VERSION >= 4
-            MPI_Recv_init_c(buffer.data(),                        // buf
-                            buffer.size(),                        // count
-                            kamping::mpi_datatype<value_type>(),  // datatype
-                            MPI_ANY_SOURCE,                       // source
-                            tag_,                                 // tag
-                            comm_,                                // comm
-                            &request                              // request
-            );
-#else
-            MPI_Recv_init(buffer.data(),                        // buf
-                          static_cast<int>(buffer.size()),      // count
-                          kamping::mpi_datatype<value_type>(),  // datatype
-                          MPI_ANY_SOURCE,                       // source
-                          tag_,                                 // tag
-                          comm_,                                // comm
-                          &request                              // request
-            );
-#endif
-            MPI_Start(&request);
+        for (std::size_t index = 0; index < receive_requests_.size(); index++) {
+            receive_buffers_[index].resize(buffer_size_);
+            start_receive_slot(index);
         }
     }
 
@@ -122,6 +226,8 @@ public:
                     "requests should gracefully cancel.");
             MPI_Request_free(&request);
         }
+        free_standby_receives();
+        clear_recycled_receives();
     }
 
     PersistentReceiver(const PersistentReceiver&) = delete;
@@ -147,14 +253,25 @@ public:
                     &request_completed,                          // flag
                     &status);                                    // status
         if (!request_completed || index == MPI_UNDEFINED) {
+            if (probe_recursion_depth_ == 1) {
+                retire_surplus_receive_slots(on_message);
+                if (resize_pending_) {
+                    resize_idle_slot(on_message);
+                }
+            }
             unstep_probe_recursion();
             return false;
         }
         termination_->track_receive();
+        if (buffer_handover_) {
+            hand_over_buffer(static_cast<std::size_t>(index), status, on_message);
+            unstep_probe_recursion();
+            return true;
+        }
         ReceiveBufferContainer& buffer = receive_buffers_[index];
-        auto envelope = build_envelope(buffer, status, rank_);
+        auto envelope = internal::build_envelope(buffer, status, rank_);
         on_message(std::move(envelope));
-        MPI_Start(&receive_requests_[index]);
+        restart_receives(std::span(&index, 1));
         unstep_probe_recursion();
         return true;
     }
@@ -175,66 +292,457 @@ public:
             // but when this method is called recursively in the message handler, e.g. when using indirection,
             // it is possible that some requests have finished somewhere up the call stack and have not been restarted
             // yet.
+            if (probe_recursion_depth_ == 1) {
+                retire_surplus_receive_slots(on_message);
+                if (resize_pending_) {
+                    resize_idle_slot(on_message);
+                }
+            }
             unstep_probe_recursion();
             return false;
         }
+        deliver_completed_receives(static_cast<std::size_t>(num_completed), statuses_buf, indices_buf, on_message);
+        unstep_probe_recursion();
+        return true;
+    }
+
+    /// @return the posted receives, so that they can be waited on along with other requests
+    [[nodiscard]] std::span<MPI_Request const> requests() const {
+        return receive_requests_;
+    }
+
+    /// Handle the receives of the slots \p indices, which have been completed with \p statuses by waiting on a copy
+    /// of requests().
+    bool handle_completed_receives(std::span<const int> indices,
+                                   std::span<const MPI_Status> statuses,
+                                   MessageHandler<value_type, std::span<value_type>> auto&& on_message) {
+        if (indices.empty()) {
+            // nothing to restart, and MPI_Startall may reject the null array of an empty vector
+            return false;
+        }
+        auto [statuses_buf, indices_buf] = step_probe_recursion();
+        std::ranges::copy(indices, indices_buf.begin());
+        std::ranges::copy(statuses, statuses_buf.begin());
+        deliver_completed_receives(indices.size(), statuses_buf, indices_buf, on_message);
+        unstep_probe_recursion();
+        return true;
+    }
+
+    /// Let the number of receive slots vary between \p min_num_receive_slots and \p max_num_receive_slots. Missing
+    /// slots are posted right away, surplus slots are retired on one of the next probes.
+    void set_receive_slot_bounds(std::size_t min_num_receive_slots, std::size_t max_num_receive_slots) {
+        KASSERT(0 < min_num_receive_slots && min_num_receive_slots <= max_num_receive_slots);
+        KASSERT(probe_recursion_depth_ == 0, "The receive slots cannot change while probing.");
+        min_num_receive_slots_ = min_num_receive_slots;
+        max_num_receive_slots_ = max_num_receive_slots;
+        if (num_receive_slots() < min_num_receive_slots_) {
+            add_receive_slots(min_num_receive_slots_ - num_receive_slots());
+        }
+    }
+
+    [[nodiscard]] std::size_t num_receive_slots() const {
+        return receive_requests_.size();
+    }
+
+    /// Hand the receive buffers over to the handler instead of passing a span into them (see class description).
+    void set_buffer_handover(bool handover) {
+        buffer_handover_ = handover;
+        if (!buffer_handover_) {
+            clear_recycled_receives();
+        }
+    }
+
+    /// Return a buffer taken from an envelope, so that it can be reused for receiving. Buffers which do not have the
+    /// current buffer size, e.g. released ones or ones received before the last resize, are dropped.
+    void recycle_buffer(ReceiveBufferContainer&& buffer) {
+        recycle_receive(RecycledReceive{.buffer = std::move(buffer)});
+    }
+
+    void recycle_buffer(HandedOverBuffer<ReceiveBufferContainer>&& buffer) {
+        recycle_buffer(std::move(buffer.buffer()));
+    }
+
+    /// @return the number of persistent receives which have been created
+    [[nodiscard]] std::size_t num_receive_inits() const {
+        return num_receive_inits_;
+    }
+
+    /// Restart completed receives before their messages are handled (see class description). This doubles the memory
+    /// for receive buffers. Buffer handover restarts early by itself, so this has no effect with it.
+    void set_early_restart(bool early_restart) {
+        KASSERT(probe_recursion_depth_ == 0, "The receive slots cannot change while probing.");
+        free_standby_receives();
+        if (early_restart) {
+            add_standby_receives(0);
+        }
+    }
+
+    /// @return the number of receives which have been restarted early, i.e. before their messages were handled
+    [[nodiscard]] std::size_t num_early_restarts() const {
+        return num_early_restarts_;
+    }
+
+    /// Let the slots receive into buffers of \p new_size elements from now on (see class description). This is not
+    /// collective, so messages which do not fit into the old size must only be sent once resize_pending() is false.
+    void resize_buffers(std::size_t new_size, MessageHandler<value_type, std::span<value_type>> auto&& /*on_message*/) {
+        buffer_size_ = new_size;
+        clear_recycled_receives();
+        next_slot_to_resize_ = 0;
+        resize_pending_ = true;
+    }
+
+    /// @return true while some slots may still receive into buffers of the size before the last resize_buffers()
+    [[nodiscard]] bool resize_pending() const {
+        return resize_pending_;
+    }
+
+    [[nodiscard]] std::size_t buffer_size() const {
+        return buffer_size_;
+    }
+
+private:
+    /// A buffer for buffer handover, with the inactive persistent receive bound to it (if any).
+    struct RecycledReceive {
+        ReceiveBufferContainer buffer;
+        MPI_Request request = MPI_REQUEST_NULL;
+    };
+
+    /// Pass the messages of the first \p num_completed receives in \p indices_buf to \p on_message and restart the
+    /// receives.
+    void deliver_completed_receives(std::size_t num_completed,
+                                    std::vector<MPI_Status>& statuses_buf,
+                                    std::vector<int>& indices_buf,
+                                    MessageHandler<value_type, std::span<value_type>> auto&& on_message) {
         auto indices = std::span(indices_buf).first(num_completed);
-        auto statuses = std::span(statuses_buf).first(num_completed);
-        auto buffers = indices | std::views::transform([&](int index) -> auto& { return receive_buffers_[index]; });
-        auto requests = indices | std::views::transform([&](int index) -> auto& { return receive_requests_[index]; });
+        if (buffer_handover_) {
+            for (std::size_t i = 0; i < num_completed; i++) {
+                termination_->track_receive();
+                hand_over_buffer(static_cast<std::size_t>(indices[i]), statuses_buf[i], on_message);
+            }
+        } else if (!standby_requests_.empty() && probe_recursion_depth_ == 1) {
+            // the standby buffers are only handed out at the outermost level, so no handler up the stack still reads
+            // the buffer of a receive we restart
+            for (int index : indices) {
+                std::swap(receive_requests_[index], standby_requests_[index]);
+                std::swap(receive_buffers_[index], standby_buffers_[index]);
+            }
+            restart_receives(indices);
+            num_early_restarts_ += num_completed;
+            for (std::size_t i = 0; i < num_completed; i++) {
+                termination_->track_receive();
+                on_message(internal::build_envelope(standby_buffers_[indices[i]], statuses_buf[i], rank_));
+            }
+            if (resize_pending_) {
+                for (int index : indices) {
+                    resize_standby_receive(static_cast<std::size_t>(index));
+                }
+            }
+        } else {
+            for (std::size_t i = 0; i < num_completed; i++) {
+                termination_->track_receive();
+                on_message(internal::build_envelope(receive_buffers_[indices[i]], statuses_buf[i], rank_));
+            }
+            restart_receives(indices);
+        }
+        // the slots may only change if no caller up the stack is iterating over them
+        if (probe_recursion_depth_ == 1 && min_num_receive_slots_ < max_num_receive_slots_) {
+            adapt_num_receive_slots(num_completed, on_message);
+        } else if (probe_recursion_depth_ == 1) {
+            retire_surplus_receive_slots(on_message);
+        }
+        if (resize_pending_ && probe_recursion_depth_ == 1) {
+            resize_idle_slot(on_message);
+        }
+    }
 
-#ifdef BRIEFKASTEN_CXX20
-        namespace views = ranges::views;
+    /// Create the persistent receive for slot \p index and start it.
+    void start_receive_slot(std::size_t index) {
+        init_receive(receive_buffers_[index], receive_requests_[index]);
+        MPI_Start(&receive_requests_[index]);
+    }
+
+    /// Create a persistent receive into \p buffer, without starting it.
+    void init_receive(ReceiveBufferContainer& buffer, MPI_Request& request) {
+        num_receive_inits_++;
+#if MPI_VERSION >= 4
+        MPI_Recv_init_c(buffer.data(),                        // buf
+                        buffer.size(),                        // count
+                        kamping::mpi_datatype<value_type>(),  // datatype
+                        MPI_ANY_SOURCE,                       // source
+                        tag_,                                 // tag
+                        comm_,                                // comm
+                        &request                              // request
+        );
 #else
-        namespace views = std::views;
+        MPI_Recv_init(buffer.data(),                        // buf
+                      static_cast<int>(buffer.size()),      // count
+                      kamping::mpi_datatype<value_type>(),  // datatype
+                      MPI_ANY_SOURCE,                       // source
+                      tag_,                                 // tag
+                      comm_,                                // comm
+                      &request                              // request
+        );
 #endif
-        for (auto [buffer, status, request] : views::zip(buffers, statuses, requests)) {
-            termination_->track_receive();
-            auto envelope = internal::build_envelope(buffer, status, rank_);
-            on_message(std::move(envelope));
-            MPI_Start(&request);
+    }
+
+    /// Start the receives of the slots \p indices at once. Slots with a buffer of an outdated size get a new one.
+    void restart_receives(std::span<const int> indices) {
+        restart_requests_.clear();
+        for (int index : indices) {
+            if (receive_buffers_[index].size() != buffer_size_) {
+                // the persistent request is bound to the old buffer
+                MPI_Request_free(&receive_requests_[index]);
+                receive_buffers_[index].resize(buffer_size_);
+                init_receive(receive_buffers_[index], receive_requests_[index]);
+            }
+            restart_requests_.push_back(receive_requests_[index]);
+        }
+        MPI_Startall(static_cast<int>(restart_requests_.size()), restart_requests_.data());
+        // MPI may update the handles
+        for (std::size_t i = 0; i < indices.size(); i++) {
+            receive_requests_[indices[i]] = restart_requests_[i];
         }
-        unstep_probe_recursion();
-        return true;
     }
 
-    void resize_buffers(std::size_t new_size, MessageHandler<value_type, std::span<value_type>> auto&& on_message) {
-        std::vector<MPI_Status> statuses(receive_requests_.size());
-        for (MPI_Request& request : receive_requests_) {
-            MPI_Cancel(&request);
+    /// Create the inactive standby receives for early restart of the slots starting at \p first_slot.
+    void add_standby_receives(std::size_t first_slot) {
+        standby_requests_.resize(num_receive_slots(), MPI_REQUEST_NULL);
+        // a deque does not move the existing buffers, which are referenced by the standby receives
+        standby_buffers_.resize(num_receive_slots());
+        for (std::size_t index = first_slot; index < num_receive_slots(); index++) {
+            standby_buffers_[index].resize(buffer_size_);
+            init_receive(standby_buffers_[index], standby_requests_[index]);
         }
-        MPI_Waitall(static_cast<int>(receive_requests_.size()), receive_requests_.data(), statuses.data());
-#ifdef BRIEFKASTEN_CXX20
-        namespace views = ranges::views;
+    }
+
+    /// Give the inactive standby receive of slot \p index a buffer of the current size, if it has an outdated one.
+    void resize_standby_receive(std::size_t index) {
+        if (standby_buffers_[index].size() == buffer_size_) {
+            return;
+        }
+        MPI_Request_free(&standby_requests_[index]);
+        standby_buffers_[index].resize(buffer_size_);
+        init_receive(standby_buffers_[index], standby_requests_[index]);
+    }
+
+    /// Repost the next slot which still has a buffer of an outdated size, so that a resize completes even if some
+    /// slots never receive anything. A message which already matched the slot is handed to \p on_message.
+    void resize_idle_slot(MessageHandler<value_type, std::span<value_type>> auto&& on_message) {
+        for (; next_slot_to_resize_ < num_receive_slots(); next_slot_to_resize_++) {
+            std::size_t index = next_slot_to_resize_;
+            if (!standby_requests_.empty()) {
+                resize_standby_receive(index);
+            }
+            if (receive_buffers_[index].size() == buffer_size_) {
+                continue;
+            }
+            // before the handler runs, which may resize again and start over
+            next_slot_to_resize_++;
+            MPI_Status status;
+            MPI_Cancel(&receive_requests_[index]);
+            MPI_Wait(&receive_requests_[index], &status);
+            int cancelled = 0;
+            MPI_Test_cancelled(&status, &cancelled);
+            if (!cancelled) {
+                termination_->track_receive();
+                on_message(internal::build_envelope(receive_buffers_[index], status, rank_));
+            }
+            MPI_Request_free(&receive_requests_[index]);
+            receive_buffers_[index].resize(buffer_size_);
+            start_receive_slot(index);
+            return;
+        }
+        resize_pending_ = false;
+    }
+
+    void free_standby_receives() {
+        for (MPI_Request& request : standby_requests_) {
+            MPI_Request_free(&request);
+        }
+        standby_requests_.clear();
+        standby_buffers_.clear();
+    }
+
+    /// Swap the buffer and the persistent receive of slot \p index with recycled ones and restart the receive, before
+    /// passing the received buffer to \p on_message.
+    void hand_over_buffer(std::size_t index,
+                          MPI_Status const& status,
+                          MessageHandler<value_type, std::span<value_type>> auto&& on_message) {
+        RecycledReceive received = acquire_receive();
+        std::swap(receive_buffers_[index], received.buffer);
+        std::swap(receive_requests_[index], received.request);
+        if (receive_requests_[index] == MPI_REQUEST_NULL) {
+            init_receive(receive_buffers_[index], receive_requests_[index]);
+        }
+        MPI_Start(&receive_requests_[index]);
+        if (received.buffer.size() == buffer_size_) {
+            // the handler may move the buffer out of the envelope, its request waits for it to be recycled
+            park_request(received.buffer.data(), received.request);
+        } else {
+            // received before the last resize, the request does not fit the buffers we post now
+            MPI_Request_free(&received.request);
+        }
+#if MPI_VERSION >= 4
+        MPI_Count count = 0;
+        MPI_Get_count_c(&status, kamping::mpi_datatype<value_type>(), &count);
 #else
-        namespace views = std::views;
+        int count = 0;
+        MPI_Get_count(&status, kamping::mpi_datatype<value_type>(), &count);
 #endif
-        for (auto& [buffer, request, status] : views::zip(receive_buffers_, receive_requests_, statuses)) {
+        auto envelope = MessageEnvelope<HandedOverBuffer<ReceiveBufferContainer>>{
+            HandedOverBuffer<ReceiveBufferContainer>(std::move(received.buffer), static_cast<std::size_t>(count)),
+            status.MPI_SOURCE, rank_, status.MPI_TAG};
+        on_message(std::move(envelope));
+        // empty if the handler took the buffer
+        recycle_buffer(std::move(envelope.message));
+    }
+
+    /// @return a buffer of the current size, along with its inactive persistent receive if it still has one
+    RecycledReceive acquire_receive() {
+        RecycledReceive receive;
+        if (!recycled_receives_.empty()) {
+            receive = std::move(recycled_receives_.back());
+            recycled_receives_.pop_back();
+        } else {
+            receive.buffer.resize(buffer_size_);
+        }
+        if (receive.request == MPI_REQUEST_NULL) {
+            // the allocator may have handed out the memory of a dropped buffer, whose request is still parked
+            receive.request = unpark_request(receive.buffer.data());
+        }
+        return receive;
+    }
+
+    void recycle_receive(RecycledReceive&& receive) {
+        if (receive.request == MPI_REQUEST_NULL) {
+            receive.request = unpark_request(receive.buffer.data());
+        }
+        if (buffer_handover_ && receive.buffer.size() == buffer_size_ &&
+            recycled_receives_.size() < num_receive_slots()) {
+            recycled_receives_.emplace_back(std::move(receive));
+        } else if (receive.request != MPI_REQUEST_NULL) {
+            MPI_Request_free(&receive.request);
+        }
+    }
+
+    /// Keep the inactive persistent receive \p request into the buffer at \p data until the buffer is recycled. At
+    /// most one request per receive slot is parked, the oldest one is freed to make room.
+    void park_request(value_type const* data, MPI_Request request) {
+        if (parked_requests_.size() >= num_receive_slots()) {
+            MPI_Request_free(&parked_requests_.front().second);
+            parked_requests_.erase(parked_requests_.begin());
+        }
+        parked_requests_.emplace_back(data, request);
+    }
+
+    /// @return the parked request into the buffer at \p data, or MPI_REQUEST_NULL if there is none
+    MPI_Request unpark_request(value_type const* data) {
+        if (data == nullptr) {
+            return MPI_REQUEST_NULL;
+        }
+        auto it = std::ranges::find(parked_requests_, data, &std::pair<value_type const*, MPI_Request>::first);
+        if (it == parked_requests_.end()) {
+            return MPI_REQUEST_NULL;
+        }
+        MPI_Request request = it->second;
+        parked_requests_.erase(it);
+        return request;
+    }
+
+    void clear_recycled_receives() {
+        for (RecycledReceive& receive : recycled_receives_) {
+            if (receive.request != MPI_REQUEST_NULL) {
+                MPI_Request_free(&receive.request);
+            }
+        }
+        recycled_receives_.clear();
+        for (auto& [data, request] : parked_requests_) {
+            MPI_Request_free(&request);
+        }
+        parked_requests_.clear();
+    }
+
+    /// Grow the receive slots if all of them completed at once, shrink them if they stay mostly idle.
+    void adapt_num_receive_slots(std::size_t num_completed,
+                                 MessageHandler<value_type, std::span<value_type>> auto&& on_message) {
+        if (num_receive_slots() > max_num_receive_slots_) {
+            retire_surplus_receive_slots(on_message);
+        } else if (num_completed == num_receive_slots() && num_receive_slots() < max_num_receive_slots_) {
+            add_receive_slots(std::min(max_num_receive_slots_, 2 * num_receive_slots()) - num_receive_slots());
+        } else {
+            peak_completed_receives_ = std::max(peak_completed_receives_, num_completed);
+            if (++probes_since_resize_ < RECEIVE_SLOT_SHRINK_INTERVAL) {
+                return;
+            }
+            if (4 * peak_completed_receives_ <= num_receive_slots() && num_receive_slots() > min_num_receive_slots_) {
+                retire_receive_slots(num_receive_slots() - std::max(min_num_receive_slots_, num_receive_slots() / 2),
+                                     on_message);
+            }
+        }
+        peak_completed_receives_ = 0;
+        probes_since_resize_ = 0;
+    }
+
+    void add_receive_slots(std::size_t num_slots) {
+        std::size_t first_new_slot = num_receive_slots();
+        receive_requests_.resize(first_new_slot + num_slots, MPI_REQUEST_NULL);
+        // a deque does not move the existing buffers, which are referenced by the active receives
+        receive_buffers_.resize(first_new_slot + num_slots);
+        resize_scratch_buffers();
+        for (std::size_t index = first_new_slot; index < num_receive_slots(); index++) {
+            receive_buffers_[index].resize(buffer_size_);
+            start_receive_slot(index);
+        }
+        if (!standby_requests_.empty()) {
+            add_standby_receives(first_new_slot);
+        }
+    }
+
+    /// Retire the slots beyond the upper bound, e.g. after set_receive_slot_bounds() lowered it.
+    void retire_surplus_receive_slots(MessageHandler<value_type, std::span<value_type>> auto&& on_message) {
+        if (num_receive_slots() > max_num_receive_slots_) {
+            retire_receive_slots(num_receive_slots() - max_num_receive_slots_, on_message);
+        }
+    }
+
+    /// Cancel the last \p num_slots receives. A receive which already matched a message cannot be cancelled, so that
+    /// message is handed to \p on_message.
+    void retire_receive_slots(std::size_t num_slots,
+                              MessageHandler<value_type, std::span<value_type>> auto&& on_message) {
+        for (std::size_t i = 0; i < num_slots; i++) {
+            MPI_Request& request = receive_requests_.back();
+            MPI_Status status;
+            MPI_Cancel(&request);
+            MPI_Wait(&request, &status);
             int cancelled = 0;
             MPI_Test_cancelled(&status, &cancelled);
             if (!cancelled) {
                 termination_->track_receive();
-                auto envelope = build_envelope(buffer, status, rank_);
+                auto envelope = internal::build_envelope(receive_buffers_.back(), status, rank_);
                 on_message(std::move(envelope));
             }
             MPI_Request_free(&request);
-            buffer.resize(new_size);
-            MPI_Recv_init_c(buffer.data(),                        // buf
-                            buffer.size(),                        // count
-                            kamping::mpi_datatype<value_type>(),  // datatype
-                            MPI_ANY_SOURCE,                       // source
-                            tag_,                                 // tag
-                            comm_,                                // comm
-                            &request                              // request
-            );
+            receive_requests_.pop_back();
+            receive_buffers_.pop_back();
+            if (!standby_requests_.empty()) {
+                MPI_Request_free(&standby_requests_.back());
+                standby_requests_.pop_back();
+                standby_buffers_.pop_back();
+            }
         }
+        resize_scratch_buffers();
     }
 
-    [[nodiscard]] std::size_t buffer_size() const {
-        return receive_buffers_.front().size();
+    /// The statuses and indices of each recursion level have one entry per receive slot.
+    void resize_scratch_buffers() {
+        for (auto& statuses : statuses_) {
+            statuses.resize(num_receive_slots());
+        }
+        for (auto& indices : indices_) {
+            indices.resize(num_receive_slots());
+        }
     }
 
-private:
     auto step_probe_recursion() -> std::tuple<std::vector<MPI_Status>&, std::vector<int>&> {
         probe_recursion_depth_++;
         if (probe_recursion_depth_ >= static_cast<int>(statuses_.size())) {
@@ -251,14 +759,33 @@ private:
     MPI_Comm comm_;
     int tag_;
     std::vector<MPI_Request> receive_requests_;
-    std::vector<ReceiveBufferContainer> receive_buffers_;
+    std::deque<ReceiveBufferContainer> receive_buffers_;
     std::vector<std::vector<MPI_Status>> statuses_;
     std::vector<std::vector<int>> indices_;
     int probe_recursion_depth_ = 0;  // FIXME step_probe_recursion increments before use, so statuses_[0]/indices_[0] are never accessed
     internal::TerminationCounter* termination_;
     int rank_ = 0;
+    std::size_t min_num_receive_slots_;
+    std::size_t max_num_receive_slots_;
+    std::size_t peak_completed_receives_ = 0;
+    std::size_t probes_since_resize_ = 0;
+    std::size_t buffer_size_;  // of newly posted receives, older ones may still have a different size
+    std::size_t next_slot_to_resize_ = 0;
+    bool resize_pending_ = false;
+    bool buffer_handover_ = false;
+    std::vector<RecycledReceive> recycled_receives_;
+    // by buffer data, the persistent receives of buffers which the handlers have taken
+    std::vector<std::pair<value_type const*, MPI_Request>> parked_requests_;
+    std::size_t num_receive_inits_ = 0;
+    std::vector<MPI_Request> restart_requests_;
+    // with early restart, an inactive second receive per slot, which swaps with the active one when it completes
+    std::vector<MPI_Request> standby_requests_;
+    std::deque<ReceiveBufferContainer> standby_buffers_;
+    std::size_t num_early_restarts_ = 0;
 };
 
+/// Receives messages by matched probes (MPI_Improbe) and matched receives into a fixed number of buffers, instead of
+/// keeping receives posted. Which one is faster depends on the MPI implementation.
 template <MPIBuffer ReceiveBufferContainer>
 class ProbeReceiver {
 public:
@@ -271,13 +798,14 @@ public:
                   std::size_t reserved_receive_buffer_size)  // NOLINTEND(*-easily-swappable-parameters)
         : comm_(comm),
           tag_(tag),
-          receive_buffers_(num_receive_slots),
+          receive_buffers_(1, std::vector<ReceiveBufferContainer>(num_receive_slots)),
           receive_requests_(num_receive_slots, MPI_REQUEST_NULL),
           termination_(&termination_counter),
-          statuses_(num_receive_slots) {
+          statuses_(1, std::vector<MPI_Status>(num_receive_slots)),
+          reserved_receive_buffer_size_(reserved_receive_buffer_size) {
         KASSERT(tag < kamping::mpi_env.tag_upper_bound());
         MPI_Comm_rank(comm_, &rank_);
-        for (ReceiveBufferContainer& buffer : receive_buffers_) {
+        for (ReceiveBufferContainer& buffer : receive_buffers_.front()) {
             buffer.resize(reserved_receive_buffer_size);
         }
     }
@@ -294,21 +822,29 @@ public:
         if (!probe_successful) {
             return false;
         }
-        auto& buffer = receive_buffers_.front();
+        auto& buffer = step_probe_recursion().front();
+#if MPI_VERSION >= 4
         MPI_Mrecv_c(buffer.data(), buffer.size(), kamping::mpi_datatype<value_type>(), &message, &status);
+#else
+        MPI_Mrecv(buffer.data(), static_cast<int>(buffer.size()), kamping::mpi_datatype<value_type>(), &message,
+                  &status);
+#endif
         termination_->track_receive();
         auto envelope = internal::build_envelope(buffer, status, rank_);
         on_message(std::move(envelope));
+        unstep_probe_recursion();
         return true;
     }
 
     bool probe_for_messages(MessageHandler<value_type, std::span<value_type>> auto&& on_message) {
-        return probe_for_messages(std::forward<decltype(on_message)>(on_message), receive_buffers_.size());
+        return probe_for_messages(std::forward<decltype(on_message)>(on_message), receive_requests_.size());
     }
 
     bool probe_for_messages(MessageHandler<value_type, std::span<value_type>> auto&& on_message,
                             std::size_t max_receives) {
-        // TODO check if this works when called recursively
+        // a handler may probe again, so each recursion level receives into its own buffers
+        std::vector<ReceiveBufferContainer>& receive_buffers = step_probe_recursion();
+        std::vector<MPI_Status>& statuses = statuses_[probe_recursion_depth_ - 1];
         MPI_Message message = MPI_MESSAGE_NULL;
         MPI_Status status;
         int probe_successful = 1;
@@ -318,14 +854,15 @@ public:
             if (num_recvs == 0) {
                 return;
             }
-            MPI_Waitall(num_recvs, receive_requests_.data(), statuses_.data());
-            auto buffers = std::span(receive_buffers_).first(num_recvs);
+            // all receives are complete before the handlers run, so nested probes may reuse the requests
+            MPI_Waitall(static_cast<int>(num_recvs), receive_requests_.data(), statuses.data());
+            auto buffers = std::span(receive_buffers).first(num_recvs);
 #ifdef BRIEFKASTEN_CXX20
             namespace views = ranges::views;
 #else
             namespace views = std::views;
 #endif
-            for (auto& [buffer, status] : views::zip(buffers, statuses_)) {
+            for (auto [buffer, status] : views::zip(buffers, std::span(statuses).first(num_recvs))) {
                 termination_->track_receive();
                 auto envelope = internal::build_envelope(buffer, status, rank_);
                 on_message(std::move(envelope));
@@ -338,36 +875,95 @@ public:
             if (!probe_successful) {
                 continue;
             }
-            auto& buffer = receive_buffers_[num_recvs];
+            auto& buffer = receive_buffers[num_recvs];
             auto& request = receive_requests_[num_recvs];
 
+#if MPI_VERSION >= 4
             MPI_Imrecv_c(buffer.data(), buffer.size(), kamping::mpi_datatype<value_type>(), &message, &request);
+#else
+            MPI_Imrecv(buffer.data(), static_cast<int>(buffer.size()), kamping::mpi_datatype<value_type>(), &message,
+                       &request);
+#endif
             num_recvs++;
-            if (num_recvs == receive_buffers_.size()) {
+            if (num_recvs == receive_buffers.size()) {
                 receive_all();
             }
             round++;
         }
         receive_all();
-        return round == 0;  // No messages available
+        unstep_probe_recursion();
+        return round > 0;
     }
 
+    /// The buffers of each recursion level get the new size when they are used next, so handlers up the stack keep
+    /// theirs. Messages are received right after probing, so no receive is left with a buffer of the old size.
     void resize_buffers(std::size_t new_size, MessageHandler<value_type, std::span<value_type>> auto&& /*on_message*/) {
-        for (auto& buffer : receive_buffers_) {
-            buffer.resize(new_size);
+        reserved_receive_buffer_size_ = new_size;
+    }
+
+    [[nodiscard]] bool resize_pending() const {
+        return false;
+    }
+
+    [[nodiscard]] std::size_t num_receive_slots() const {
+        return receive_requests_.size();
+    }
+
+    /// The number of messages received per batch is fixed to \p max_num_receive_slots, as there are no receives
+    /// which would stay posted.
+    void set_receive_slot_bounds(std::size_t min_num_receive_slots, std::size_t max_num_receive_slots) {
+        KASSERT(0 < min_num_receive_slots && min_num_receive_slots <= max_num_receive_slots);
+        KASSERT(probe_recursion_depth_ == 0, "The receive slots cannot change while probing.");
+        receive_requests_.resize(max_num_receive_slots, MPI_REQUEST_NULL);
+        for (auto& statuses : statuses_) {
+            statuses.resize(max_num_receive_slots);
+        }
+        for (auto& receive_buffers : receive_buffers_) {
+            receive_buffers.resize(max_num_receive_slots);
+            for (auto& buffer : receive_buffers) {
+                buffer.resize(reserved_receive_buffer_size_);
+            }
         }
     }
 
 private:
+    auto step_probe_recursion() -> std::vector<ReceiveBufferContainer>& {
+        if (probe_recursion_depth_ == receive_buffers_.size()) {
+            auto& receive_buffers = receive_buffers_.emplace_back(num_receive_slots());
+            for (auto& buffer : receive_buffers) {
+                buffer.resize(reserved_receive_buffer_size_);
+            }
+            statuses_.emplace_back(num_receive_slots());
+        }
+        auto& receive_buffers = receive_buffers_[probe_recursion_depth_++];
+        if (!receive_buffers.empty() && receive_buffers.front().size() != reserved_receive_buffer_size_) {
+            for (auto& buffer : receive_buffers) {
+                buffer.resize(reserved_receive_buffer_size_);
+            }
+        }
+        return receive_buffers;
+    }
+
+    void unstep_probe_recursion() {
+        probe_recursion_depth_--;
+    }
+
     MPI_Comm comm_;
     int tag_;
-    std::vector<ReceiveBufferContainer> receive_buffers_;
+    std::deque<std::vector<ReceiveBufferContainer>> receive_buffers_;  // one set per recursion level
     std::vector<MPI_Request> receive_requests_;
-    std::vector<MPI_Status> statuses_;
     internal::TerminationCounter* termination_;
+    std::deque<std::vector<MPI_Status>> statuses_;
+    std::size_t reserved_receive_buffer_size_;
+    std::size_t probe_recursion_depth_ = 0;
     int rank_ = 0;
 };
 
+/// Receives messages of arbitrary size into newly allocated buffers, which are handed to the handler.
+///
+/// Optionally, buffers are recycled in a pool with power-of-two size classes (see internal::BufferPool). Buffers which
+/// the handler leaves in the envelope, or hands back via recycle_buffer(), go to the pool as long as it retains at most
+/// a configurable number of bytes.
 template <MPIBuffer ReceiveBufferContainer>
 class AllocatingProbeReceiver {
 public:
@@ -395,7 +991,6 @@ public:
             return false;
         }
 
-        ReceiveBufferContainer buffer;
 #if MPI_VERSION >= 4
         MPI_Count count = 0;
         MPI_Get_count_c(&status, kamping::mpi_datatype<value_type>(), &count);
@@ -403,7 +998,7 @@ public:
         int count = 0;
         MPI_Get_count(&status, kamping::mpi_datatype<value_type>(), &count);
 #endif
-        buffer.resize(count);
+        ReceiveBufferContainer buffer = buffer_pool_.acquire(static_cast<std::size_t>(count));
 #if MPI_VERSION >= 4
         MPI_Mrecv_c(buffer.data(), buffer.size(), kamping::mpi_datatype<value_type>(), &message, &status);
 #else
@@ -414,6 +1009,8 @@ public:
         auto envelope =
             MessageEnvelope<ReceiveBufferContainer>{std::move(buffer), status.MPI_SOURCE, rank_, status.MPI_TAG};
         on_message(std::move(envelope));
+        // whatever the handler left in the envelope, buffers without capacity are dropped
+        recycle_buffer(std::move(envelope.message));
         return true;
     }
 
@@ -428,12 +1025,22 @@ public:
             if (!probe_successful) {
                 continue;
             }
+#if MPI_VERSION >= 4
             MPI_Count count = 0;
             MPI_Get_count_c(&status, kamping::mpi_datatype<value_type>(), &count);
-            auto& buffer = receive_buffers_.emplace_back(count);
+#else
+            int count = 0;
+            MPI_Get_count(&status, kamping::mpi_datatype<value_type>(), &count);
+#endif
+            auto& buffer = receive_buffers_.emplace_back(buffer_pool_.acquire(static_cast<std::size_t>(count)));
             auto& request = receive_requests_.emplace_back(MPI_REQUEST_NULL);
 
+#if MPI_VERSION >= 4
             MPI_Imrecv_c(buffer.data(), buffer.size(), kamping::mpi_datatype<value_type>(), &message, &request);
+#else
+            MPI_Imrecv(buffer.data(), static_cast<int>(buffer.size()), kamping::mpi_datatype<value_type>(), &message,
+                       &request);
+#endif
             round++;
         }
         if (round == 0) {
@@ -451,6 +1058,7 @@ public:
             auto envelope =
                 MessageEnvelope<ReceiveBufferContainer>{std::move(buffer), status.MPI_SOURCE, rank_, status.MPI_TAG};
             on_message(std::move(envelope));
+            recycle_buffer(std::move(envelope.message));
         }
         receive_buffers_.resize(0);
         receive_requests_.resize(0);
@@ -458,6 +1066,25 @@ public:
         return true;
     }
 
+    /// Retain at most \p max_retained_bytes in recycled buffers. 0 disables recycling.
+    void set_buffer_pool_capacity(std::size_t max_retained_bytes) {
+        buffer_pool_.set_capacity(max_retained_bytes);
+    }
+
+    /// Return a buffer taken from an envelope, so that it can be reused for receiving.
+    void recycle_buffer(ReceiveBufferContainer&& buffer) {
+        buffer_pool_.recycle(std::move(buffer));
+    }
+
+    /// @return the pool of recycled buffers, which other receivers of large messages may share
+    [[nodiscard]] internal::BufferPool<ReceiveBufferContainer>& buffer_pool() {
+        return buffer_pool_;
+    }
+
+    [[nodiscard]] internal::BufferPool<ReceiveBufferContainer> const& buffer_pool() const {
+        return buffer_pool_;
+    }
+
 private:
     MPI_Comm comm_;
     int tag_;
@@ -466,6 +1093,132 @@ private:
     std::vector<MPI_Status> statuses_;
     internal::TerminationCounter* termination_;
     int rank_ = 0;
+    internal::BufferPool<ReceiveBufferContainer> buffer_pool_;
+};
+
+/// Receives messages sent with partitioned communication (see Sender::enqueue_partitioned_for_sending()). As the
+/// receive has to be posted with the correct size before the data arrives, each message is announced by a header of
+/// the form {number of elements, number of partitions} on \c header_tag. For each header, a buffer of the announced
+/// size is allocated and a matching partitioned receive is started on \c tag. Messages are handed to the handler once
+/// all partitions have arrived.
+///
+/// Headers are not counted for termination, only the actual messages are.
+template <MPIBuffer ReceiveBufferContainer>
+class PartitionedReceiver {
+public:
+    using value_type = std::ranges::range_value_t<ReceiveBufferContainer>;
+    // NOLINTBEGIN(*-easily-swappable-parameters)
+    PartitionedReceiver(MPI_Comm comm,
+                        int header_tag,
+                        int tag,
+                        internal::TerminationCounter& termination_counter)  // NOLINTEND(*-easily-swappable-parameters)
+        : comm_(comm), header_tag_(header_tag), tag_(tag), termination_(&termination_counter) {
+        KASSERT(header_tag < kamping::mpi_env.tag_upper_bound());
+        KASSERT(tag < kamping::mpi_env.tag_upper_bound());
+        MPI_Comm_rank(comm_, &rank_);
+    }
+
+    ~PartitionedReceiver() {
+        for (auto& pending : pending_receives_) {
+            if (pending.request != MPI_REQUEST_NULL) {
+                MPI_Request_free(&pending.request);
+            }
+        }
+    }
+
+    PartitionedReceiver(PartitionedReceiver const&) = delete;
+
+    PartitionedReceiver(PartitionedReceiver&& other) noexcept = default;
+
+    PartitionedReceiver& operator=(PartitionedReceiver const&) = delete;
+
+    PartitionedReceiver& operator=(PartitionedReceiver&& other) noexcept {
+        if (this != &other) {
+            // member-wise assignment would drop our pending requests without freeing them
+            std::destroy_at(this);
+            std::construct_at(this, std::move(other));
+        }
+        return *this;
+    }
+
+    void rebind_termination_counter(internal::TerminationCounter& termination_counter) {
+        termination_ = &termination_counter;
+    }
+
+    /// @return the number of messages which have been announced, but not completely received yet
+    [[nodiscard]] std::size_t pending_receives() const {
+        return pending_receives_.size();
+    }
+
+    /// Pass at most \p max_messages completely received messages to \p on_message.
+    bool probe_for_messages(MessageHandler<value_type, std::span<value_type>> auto&& on_message,
+                            std::size_t max_messages = std::numeric_limits<std::size_t>::max()) {
+        if (!partitioned_communication_available()) {
+            return false;
+        }
+        post_announced_receives();
+        bool received_something = false;
+        std::size_t num_received = 0;
+        // partitioned receives from the same source may complete in any order, so we test all of them
+        for (auto it = pending_receives_.begin(); it != pending_receives_.end() && num_received < max_messages;) {
+            int finished = 0;
+            MPI_Status status;
+            MPI_Test(&it->request, &finished, &status);
+            if (!finished) {
+                it++;
+                continue;
+            }
+            MPI_Request_free(&it->request);
+            ReceiveBufferContainer buffer = std::move(it->buffer);
+            PEID source = it->source;
+            it = pending_receives_.erase(it);
+            termination_->track_receive();
+            on_message(MessageEnvelope<ReceiveBufferContainer>{std::move(buffer), source, rank_, tag_});
+            received_something = true;
+            num_received++;
+        }
+        return received_something;
+    }
+
+private:
+    struct PendingReceive {
+        ReceiveBufferContainer buffer;
+        PEID source;
+        MPI_Request request = MPI_REQUEST_NULL;
+    };
+
+    /// Receive all headers and start the partitioned receives they announce. These are matched to the partitioned
+    /// sends in the order of initialization, which is the order in which the headers are sent.
+    void post_announced_receives() {
+        std::array<std::size_t, 2> header{};
+        while (true) {
+            MPI_Message message = MPI_MESSAGE_NULL;
+            MPI_Status status;
+            int probe_successful = 0;
+            MPI_Improbe(MPI_ANY_SOURCE, header_tag_, comm_, &probe_successful, &message, &status);
+            if (!probe_successful) {
+                return;
+            }
+            MPI_Mrecv(header.data(), static_cast<int>(header.size()), kamping::mpi_datatype<std::size_t>(), &message,
+                      &status);
+            auto [count, num_partitions] = header;
+            [[maybe_unused]] auto& pending = pending_receives_.emplace_back(
+                PendingReceive{.buffer = ReceiveBufferContainer(count), .source = status.MPI_SOURCE});
+#if MPI_VERSION >= 4
+            MPI_Precv_init(pending.buffer.data(), static_cast<int>(num_partitions),
+                           static_cast<MPI_Count>(count / num_partitions), kamping::mpi_datatype<value_type>(),
+                           status.MPI_SOURCE, tag_, comm_, MPI_INFO_NULL, &pending.request);
+            MPI_Start(&pending.request);
+#endif
+        }
+    }
+
+    MPI_Comm comm_;
+    int header_tag_;
+    int tag_;
+    std::list<PendingReceive> pending_receives_;  // stable, as MPI writes into the buffers
+    internal::TerminationCounter* termination_;
+    int rank_ = 0;
 };
 
 }  // namespace briefkasten
@@ -23,91 +23,62 @@
 #include <algorithm>
 #include <concepts>
 #include <cstddef>
+#include <cstdint>
 #include <kassert/kassert.hpp>
 #include <optional>
+#include <span>
+#include <tuple>
 #include <utility>
 #include <vector>
 
-namespace briefkasten::internal {
+namespace briefkasten {
 
-enum class SearchStrategy : std::uint8_t { linear, local };
+/// Which request slots are tested for completion: only the range spanned by active slots, all slots, or all slots
+/// starting at a rotating offset (so that low slots are not always favored).
 enum class CompletionStrategy : std::uint8_t { active, all, round_robin };
 
+namespace internal {
+
+/// A resizable number of request slots. Free slots are kept on an intrusive stack (\c free_slots_, with the inverse
+/// mapping \c free_slot_position_), so acquiring and releasing a slot is O(1) regardless of the capacity. Released
+/// slots are pushed on top, i.e. the most recently completed (and most likely cache-warm) slot is reused first.
 class RequestPool {
 public:
-    RequestPool(std::size_t capacity = 0) : requests(capacity, MPI_REQUEST_NULL), indices(capacity) {}
-
-    std::optional<std::pair<int, MPI_Request&>> get_some_inactive_request(
-        int hint = -1,
-        SearchStrategy search_strategy = SearchStrategy::linear) {
-        if (inactive_requests() == 0) {
-            return {};
-        }
-
-        if (hint < 0) {
-            hint = last_slot.value_or(-1);
-            last_slot.reset();
+    RequestPool(std::size_t capacity = 0)
+        : requests(capacity, MPI_REQUEST_NULL),
+          indices(capacity),
+          free_slots_(capacity),
+          free_slot_position_(capacity) {
+        // push in reverse order, so that slot 0 is on top of the stack
+        for (std::size_t i = 0; i < capacity; i++) {
+            free_slots_[i] = static_cast<int>(capacity - i - 1);
+            free_slot_position_[capacity - i - 1] = static_cast<int>(i);
         }
+    }
 
-        // first check the hinted position
-        if (hint >= 0 && static_cast<std::size_t>(hint) < capacity() && requests[hint] == MPI_REQUEST_NULL) {
-            add_to_active_range(hint);
-            return {{hint, requests[hint]}};
-        }
-        if (search_strategy == SearchStrategy::linear) {
-            auto it = std::ranges::find(requests, MPI_REQUEST_NULL);
-            if (it == requests.end()) {
-                return std::nullopt;
-            }
-            std::size_t index = std::distance(requests.begin(), it);
-            add_to_active_range(static_cast<int>(index));
-            return {{index, *it}};
-        }
-        KASSERT(search_strategy == SearchStrategy::local);
-
-        // first try to find a request in the active range if there is one
-        if (active_requests_ < static_cast<std::size_t>(active_range.second - active_range.first)) {
-            for (auto i = active_range.first; i < active_range.second; i++) {
-                if (requests[i] == MPI_REQUEST_NULL) {
-                    add_to_active_range(i);
-                    return {{i, requests[i]}};
-                }
-            }
-        }
-        // search right of the active range
-        for (auto i = active_range.second; i < static_cast<int>(capacity()); i++) {
-            if (requests[i] == MPI_REQUEST_NULL) {
-                add_to_active_range(i);
-                return {{i, requests[i]}};
-            }
+    /// Acquire an inactive request slot. If \p hint refers to a free slot, that slot is returned, otherwise the most
+    /// recently released one.
+    std::optional<std::pair<int, MPI_Request&>> get_some_inactive_request(int hint = -1) {
+        if (free_slots_.empty()) {
+            return {};
         }
-        // search left of the active range starting at active_range.first
-        for (auto i = active_range.first - 1; i >= 0; i--) {
-            if (requests[i] == MPI_REQUEST_NULL) {
-                add_to_active_range(i);
-                return {{i, requests[i]}};
-            }
+        int index = free_slots_.back();
+        if (hint >= 0 && static_cast<std::size_t>(hint) < capacity() && free_slot_position_[hint] != OCCUPIED) {
+            index = hint;
         }
-        // this should never happen
-        return {};
+        remove_from_free_slots(index);
+        add_to_active_range(index);
+        return {{index, requests[index]}};
     }
 
-    void test_some(
+    /// Test the requests selected by \p completion_strategy and call \p on_complete for each completed slot.
+    /// @return the number of completed requests
+    std::size_t test_some(
         std::invocable<int> auto&& on_complete = [](int) {},
         CompletionStrategy completion_strategy = CompletionStrategy::all) {
         int outcount = 0;
-        auto [incount, request_ptr, index_offset] = [&]() -> std::tuple<int, MPI_Request*, int> {
-            switch (completion_strategy) {
-                case CompletionStrategy::active:
-                    return std::tuple{active_range.second - active_range.first, &requests[active_range.first],
-                                      active_range.first};
-                default:
-                case CompletionStrategy::all:
-                    return std::tuple{capacity(), requests.data(), 0};
-                case CompletionStrategy::round_robin:
-                    return std::tuple{capacity() - round_robin_index, &requests[round_robin_index], round_robin_index};
-            }
-        }();
+        std::size_t num_completed = 0;
+        auto [incount, request_ptr, index_offset] = test_range(completion_strategy);
         MPI_Testsome(incount,             // count
                      request_ptr,         // requests
                      &outcount,           // outcount
@@ -115,6 +86,7 @@ public:
                      MPI_STATUSES_IGNORE  // statuses
         );
         if (outcount != MPI_UNDEFINED) {
+            num_completed += static_cast<std::size_t>(outcount);
             std::for_each_n(indices.begin(), outcount, [&](int index) {
                 // map index to the global index
                 index += index_offset;
@@ -131,6 +103,7 @@ public:
                          MPI_STATUSES_IGNORE  // statuses
             );
             if (outcount != MPI_UNDEFINED) {
+                num_completed += static_cast<std::size_t>(outcount);
                 std::for_each_n(indices.begin(), outcount, [&](int index) {
                     remove_from_active_range(index);
                     on_complete(index);
@@ -141,6 +114,7 @@ public:
                 round_robin_index = 0;
             }
         }
+        return num_completed;
     }
 
     bool test_any(
@@ -148,18 +122,7 @@ public:
         CompletionStrategy completion_strategy = CompletionStrategy::all) {
         int flag = 0;
         int index = 0;
-        auto [incount, request_ptr, index_offset] = [&]() -> std::tuple<int, MPI_Request*, int> {
-            switch (completion_strategy) {
-                case CompletionStrategy::active:
-                    return std::tuple{active_range.second - active_range.first, &requests[active_range.first],
-                                      active_range.first};
-                default:
-                case CompletionStrategy::all:
-                    return std::tuple{capacity(), requests.data(), 0};
-                case CompletionStrategy::round_robin:
-                    return std::tuple{capacity() - round_robin_index, &requests[round_robin_index], round_robin_index};
-            }
-        }();
+        auto [incount, request_ptr, index_offset] = test_range(completion_strategy);
         MPI_Testany(incount,           // count
                     request_ptr,       // requests
                     &index,            // index
@@ -188,6 +151,17 @@ public:
         return active_requests_;
     }
 
+    /// @return the requests of all slots, so that they can be waited on along with other requests
+    [[nodiscard]] std::span<MPI_Request const> all_requests() const {
+        return requests;
+    }
+
+    /// Free slot \p index, whose request has been completed outside of the pool, e.g. by MPI_Waitsome on a copy of
+    /// all_requests().
+    void release_completed(int index) {
+        remove_from_active_range(index);
+    }
+
     [[nodiscard]] std::size_t inactive_requests() const {
         return capacity() - active_requests();
     }
@@ -196,7 +170,76 @@ public:
         return requests.size();
     }
 
+    /// Grow or shrink the pool to \p new_capacity slots. Slots holding an active request are never dropped, so
+    /// shrinking stops at the highest active slot.
+    /// @return the resulting capacity
+    std::size_t resize(std::size_t new_capacity) {
+        std::size_t old_capacity = capacity();
+        if (new_capacity > old_capacity) {
+            requests.resize(new_capacity, MPI_REQUEST_NULL);
+            indices.resize(new_capacity);
+            free_slot_position_.resize(new_capacity);
+            // new slots go below the already free ones, so cache-warm slots are still reused first
+            std::vector<int> free_slots(new_capacity - old_capacity);
+            for (std::size_t i = 0; i < free_slots.size(); i++) {
+                free_slots[i] = static_cast<int>(new_capacity - i - 1);
+            }
+            free_slots.insert(free_slots.end(), free_slots_.begin(), free_slots_.end());
+            free_slots_ = std::move(free_slots);
+            for (std::size_t position = 0; position < free_slots_.size(); position++) {
+                free_slot_position_[free_slots_[position]] = static_cast<int>(position);
+            }
+            return capacity();
+        }
+        while (capacity() > new_capacity && free_slot_position_.back() != OCCUPIED) {
+            remove_from_free_slots(static_cast<int>(capacity() - 1));
+            requests.pop_back();
+            indices.pop_back();
+            free_slot_position_.pop_back();
+        }
+        auto last_slot = static_cast<int>(capacity());
+        active_range.second = std::min(active_range.second, last_slot);
+        active_range.first = std::min(active_range.first, active_range.second);
+        if (round_robin_index >= last_slot) {
+            round_robin_index = 0;
+        }
+        return capacity();
+    }
+
 private:
+    static constexpr int OCCUPIED = -1;
+
+    /// @return (count, first request, index of the first request) of the slots to test
+    std::tuple<int, MPI_Request*, int> test_range(CompletionStrategy completion_strategy) {
+        switch (completion_strategy) {
+            case CompletionStrategy::active:
+                return std::tuple{active_range.second - active_range.first, requests.data() + active_range.first,
+                                  active_range.first};
+            default:
+            case CompletionStrategy::all:
+                return std::tuple{capacity(), requests.data(), 0};
+            case CompletionStrategy::round_robin:
+                return std::tuple{capacity() - round_robin_index, requests.data() + round_robin_index,
+                                  round_robin_index};
+        }
+    }
+
+    void remove_from_free_slots(int index) {
+        int position = free_slot_position_[index];
+        KASSERT(position != OCCUPIED);
+        int top = free_slots_.back();
+        free_slots_[position] = top;
+        free_slot_position_[top] = position;
+        free_slots_.pop_back();
+        free_slot_position_[index] = OCCUPIED;
+    }
+
+    void add_to_free_slots(int index) {
+        KASSERT(free_slot_position_[index] == OCCUPIED);
+        free_slot_position_[index] = static_cast<int>(free_slots_.size());
+        free_slots_.push_back(index);
+    }
+
     void add_to_active_range(int index) {
         active_requests_++;
         active_range.first = std::min(index, active_range.first);
@@ -204,7 +247,10 @@ private:
     }
 
     void remove_from_active_range(int index) {
-        last_slot = index;
+        // completed persistent requests stay allocated and are owned by the caller, so the slot must not keep the
+        // handle
+        requests[index] = MPI_REQUEST_NULL;
+        add_to_free_slots(index);
         active_requests_--;
         if (index == active_range.first) {
             active_range.first++;
@@ -216,10 +262,11 @@ private:
     }
     std::vector<MPI_Request> requests;
     std::vector<int> indices;
-    std::optional<int> last_slot;
-    size_t inactive_request_pointer = 0;
+    std::vector<int> free_slots_;
+    std::vector<int> free_slot_position_;
     size_t active_requests_ = 0;
     std::pair<int, int> active_range = {0, 0};
     int round_robin_index = 0;
 };
-}  // namespace briefkasten::internal
+}  // namespace internal
+}  // namespace briefkasten
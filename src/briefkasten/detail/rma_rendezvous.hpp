@@ -0,0 +1,267 @@
+// Copyright (c) 2021-2025 Tim Niklas Uhl
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of
+// this software and associated documentation files (the "Software"), to deal in
+// the Software without restriction, including without limitation the rights to
+// use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+// the Software, and to permit persons to whom the Software is furnished to do so,
+// subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+// FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+// COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+// IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#pragma once
+
+#include <array>
+#include <concepts>
+#include <cstddef>
+#include <kamping/environment.hpp>
+#include <kassert/kassert.hpp>
+#include <limits>
+#include <list>
+#include <optional>
+#include <ranges>
+#include <span>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <mpi.h>
+#include <kamping/mpi_datatype.hpp>
+
+#include "./buffer_pool.hpp"
+#include "./concepts.hpp"
+#include "./definitions.hpp"
+#include "./termination_counter.hpp"
+
+namespace briefkasten::internal {
+
+/// Transfers large messages by remote memory access instead of the rendezvous protocol of the MPI library.
+///
+/// The sender attaches the message to a dynamic window and announces it with a descriptor (address, count, receipt).
+/// The receiver pulls the message with MPI_Rget straight into a buffer of its own, so neither side copies it, and
+/// acknowledges it afterwards, so that the sender may detach and release the memory. The descriptors and
+/// acknowledgements are sent by the caller (see expose() and probe_for_messages()).
+///
+/// Messages exposed at the same address, e.g. one buffer sent to several receivers, share a single attachment, which
+/// is detached with the last acknowledgement.
+///
+/// Creating and destroying the window is collective, so all ranks of the communicator have to do so together.
+template <MPIBuffer ReceiveBufferContainer>
+class RmaRendezvous {
+public:
+    using value_type = std::ranges::range_value_t<ReceiveBufferContainer>;
+    using Descriptor = std::vector<std::size_t>;
+
+    // NOLINTBEGIN(*-easily-swappable-parameters)
+    RmaRendezvous(MPI_Comm comm,
+                  int descriptor_tag,
+                  int acknowledgement_tag,
+                  TerminationCounter& termination_counter)  // NOLINTEND(*-easily-swappable-parameters)
+        : comm_(comm),
+          descriptor_tag_(descriptor_tag),
+          acknowledgement_tag_(acknowledgement_tag),
+          termination_(&termination_counter) {
+        KASSERT(descriptor_tag < kamping::mpi_env.tag_upper_bound());
+        KASSERT(acknowledgement_tag < kamping::mpi_env.tag_upper_bound());
+        MPI_Comm_rank(comm_, &rank_);
+        MPI_Win_create_dynamic(MPI_INFO_NULL, comm_, &window_);
+        // a single passive target epoch to all ranks, which lasts as long as the window
+        MPI_Win_lock_all(MPI_MODE_NOCHECK, window_);
+    }
+
+    ~RmaRendezvous() {
+        if (window_ == MPI_WIN_NULL) {
+            return;
+        }
+        KASSERT(pending_pulls_.empty() && exposed_messages_.empty(),
+                "The rendezvous must not be destroyed while messages are in flight.");
+        MPI_Win_unlock_all(window_);
+        MPI_Win_free(&window_);
+    }
+
+    RmaRendezvous(RmaRendezvous const&) = delete;
+
+    RmaRendezvous(RmaRendezvous&& other) noexcept
+        : comm_(other.comm_),
+          descriptor_tag_(other.descriptor_tag_),
+          acknowledgement_tag_(other.acknowledgement_tag_),
+          window_(std::exchange(other.window_, MPI_WIN_NULL)),
+          exposed_messages_(std::move(other.exposed_messages_)),
+          attached_regions_(std::move(other.attached_regions_)),
+          pending_pulls_(std::move(other.pending_pulls_)),
+          termination_(other.termination_),
+          rank_(other.rank_) {}
+
+    RmaRendezvous& operator=(RmaRendezvous const&) = delete;
+    /// Swaps the windows, so the one of this rendezvous is freed along with \p other.
+    RmaRendezvous& operator=(RmaRendezvous&& other) noexcept {
+        std::swap(comm_, other.comm_);
+        std::swap(descriptor_tag_, other.descriptor_tag_);
+        std::swap(acknowledgement_tag_, other.acknowledgement_tag_);
+        std::swap(window_, other.window_);
+        std::swap(exposed_messages_, other.exposed_messages_);
+        std::swap(attached_regions_, other.attached_regions_);
+        std::swap(pending_pulls_, other.pending_pulls_);
+        std::swap(termination_, other.termination_);
+        std::swap(rank_, other.rank_);
+        return *this;
+    }
+
+    void rebind_termination_counter(TerminationCounter& termination_counter) {
+        termination_ = &termination_counter;
+    }
+
+    /// Attach \p message to the window, so that the receiver can pull it. The memory must stay valid until the
+    /// receipt is acknowledged (see probe_for_acknowledgements()). A message at the address of one which is still
+    /// exposed must not be larger than that.
+    /// @return the descriptor announcing the message to the receiver
+    auto expose(std::span<const value_type> message, std::size_t receipt) -> Descriptor {
+        KASSERT(!message.empty());
+        // the window is only read remotely, but MPI_Win_attach takes a mutable pointer
+        void* base = const_cast<value_type*>(message.data());  // NOLINT(*-const-cast)
+        auto [region, first_exposure] = attached_regions_.try_emplace(base, AttachedRegion{message.size_bytes(), 0});
+        if (first_exposure) {
+            MPI_Win_attach(window_, base, static_cast<MPI_Aint>(message.size_bytes()));
+        }
+        KASSERT(message.size_bytes() <= region->second.size_bytes,
+                "Attached memory must not overlap, so a message must fit the region attached at its address.");
+        region->second.num_exposed++;
+        MPI_Aint address = 0;
+        MPI_Get_address(base, &address);
+        exposed_messages_.emplace(receipt, base);
+        return Descriptor{static_cast<std::size_t>(address), message.size(), receipt};
+    }
+
+    /// Receive all acknowledgements, detach the acknowledged messages and report their receipts to
+    /// \p on_acknowledged.
+    bool probe_for_acknowledgements(std::invocable<std::size_t> auto&& on_acknowledged) {
+        bool acknowledged_something = false;
+        std::size_t receipt = 0;
+        while (receive_control_message(acknowledgement_tag_, std::span(&receipt, 1)).has_value()) {
+            auto it = exposed_messages_.find(receipt);
+            KASSERT(it != exposed_messages_.end(), "This message has not been exposed.");
+            auto region = attached_regions_.find(it->second);
+            KASSERT(region != attached_regions_.end() && region->second.num_exposed > 0);
+            if (--region->second.num_exposed == 0) {
+                MPI_Win_detach(window_, it->second);
+                attached_regions_.erase(region);
+            }
+            exposed_messages_.erase(it);
+            on_acknowledged(receipt);
+            acknowledged_something = true;
+        }
+        return acknowledged_something;
+    }
+
+    /// Start pulling all announced messages and pass at most \p max_messages completely pulled ones to \p on_message.
+    /// For each of them, \p on_pulled is called with the sender and receipt before, so that the acknowledgement can be
+    /// sent. The messages are pulled into buffers from \p buffer_pool, where the buffers the handler leaves in the
+    /// envelope go back.
+    bool probe_for_messages(MessageHandler<value_type, std::span<value_type>> auto&& on_message,
+                            std::invocable<PEID, std::size_t> auto&& on_pulled,
+                            BufferPool<ReceiveBufferContainer>& buffer_pool,
+                            std::size_t max_messages = std::numeric_limits<std::size_t>::max()) {
+        start_announced_pulls(buffer_pool);
+        bool received_something = false;
+        std::size_t num_received = 0;
+        for (auto it = pending_pulls_.begin(); it != pending_pulls_.end() && num_received < max_messages;) {
+            int finished = 0;
+            MPI_Test(&it->request, &finished, MPI_STATUS_IGNORE);
+            if (!finished) {
+                it++;
+                continue;
+            }
+            ReceiveBufferContainer buffer = std::move(it->buffer);
+            PEID source = it->source;
+            std::size_t receipt = it->receipt;
+            it = pending_pulls_.erase(it);
+            termination_->track_receive();
+            on_pulled(source, receipt);
+            auto envelope = MessageEnvelope<ReceiveBufferContainer>{std::move(buffer), source, rank_, descriptor_tag_};
+            on_message(std::move(envelope));
+            buffer_pool.recycle(std::move(envelope.message));
+            received_something = true;
+            num_received++;
+        }
+        return received_something;
+    }
+
+    /// @return the number of messages which have been announced, but not completely pulled yet
+    [[nodiscard]] std::size_t pending_pulls() const {
+        return pending_pulls_.size();
+    }
+
+    /// @return the number of memory regions attached to the window, one per address of unacknowledged messages
+    [[nodiscard]] std::size_t num_attached_regions() const {
+        return attached_regions_.size();
+    }
+
+private:
+    struct PendingPull {
+        ReceiveBufferContainer buffer;
+        PEID source;
+        std::size_t receipt;
+        MPI_Request request = MPI_REQUEST_NULL;
+    };
+
+    struct AttachedRegion {
+        std::size_t size_bytes;
+        std::size_t num_exposed;  // messages at this address which have not been acknowledged yet
+    };
+
+    /// Receive all descriptors and start pulling the messages they announce into buffers from \p buffer_pool.
+    void start_announced_pulls(BufferPool<ReceiveBufferContainer>& buffer_pool) {
+        std::array<std::size_t, 3> descriptor{};
+        std::optional<PEID> source;
+        while ((source = receive_control_message(descriptor_tag_, std::span(descriptor))).has_value()) {
+            auto [address, count, receipt] = descriptor;
+            auto& pull = pending_pulls_.emplace_back(
+                PendingPull{.buffer = buffer_pool.acquire(count), .source = *source, .receipt = receipt});
+            auto displacement = static_cast<MPI_Aint>(address);
+#if MPI_VERSION >= 4
+            MPI_Rget_c(pull.buffer.data(), static_cast<MPI_Count>(count), kamping::mpi_datatype<value_type>(), *source,
+                       displacement, static_cast<MPI_Count>(count), kamping::mpi_datatype<value_type>(), window_,
+                       &pull.request);
+#else
+            MPI_Rget(pull.buffer.data(), static_cast<int>(count), kamping::mpi_datatype<value_type>(), *source,
+                     displacement, static_cast<int>(count), kamping::mpi_datatype<value_type>(), window_,
+                     &pull.request);
+#endif
+        }
+    }
+
+    /// Receive a descriptor or acknowledgement with \p tag into \p message, if there is one.
+    /// @return the sender of the received message
+    auto receive_control_message(int tag, std::span<std::size_t> message) -> std::optional<PEID> {
+        MPI_Message handle = MPI_MESSAGE_NULL;
+        MPI_Status status;
+        int probe_successful = 0;
+        MPI_Improbe(MPI_ANY_SOURCE, tag, comm_, &probe_successful, &handle, &status);
+        if (!probe_successful) {
+            return std::nullopt;
+        }
+        MPI_Mrecv(message.data(), static_cast<int>(message.size()), kamping::mpi_datatype<std::size_t>(), &handle,
+                  &status);
+        return status.MPI_SOURCE;
+    }
+
+    MPI_Comm comm_;
+    int descriptor_tag_;
+    int acknowledgement_tag_;
+    MPI_Win window_ = MPI_WIN_NULL;
+    std::unordered_map<std::size_t, void*> exposed_messages_;  // by receipt, until acknowledged
+    std::unordered_map<void*, AttachedRegion> attached_regions_;  // by base address, while exposed
+    std::list<PendingPull> pending_pulls_;                     // stable, as MPI writes into the buffers
+    TerminationCounter* termination_;
+    int rank_ = 0;
+};
+
+}  // namespace briefkasten::internal
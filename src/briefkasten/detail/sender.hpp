@@ -19,18 +19,55 @@
 
 #pragma once
 
+#include <algorithm>
+#include <cstddef>
 #include <deque>
+#include <functional>
 #include <kamping/mpi_datatype.hpp>
 #include <limits>
+#include <memory>
 #include <optional>
 #include <ranges>
+#include <span>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include <mpi.h>
 
 #include "./concepts.hpp"
+#include "./definitions.hpp"
 #include "./request_pool.hpp"
 
 namespace briefkasten {
+static constexpr std::size_t SEND_SLOT_SHRINK_INTERVAL = 1024;
+static constexpr std::size_t MIN_RECEIPT_WINDOW_SIZE = 64;
+
+/// Sends messages using a fixed number of request slots. Messages which do not get a slot right away are kept in a
+/// backlog with one queue per destination. Freed slots are handed to the destinations in round-robin order, so a
+/// destination flooding the backlog does not delay messages to all other ranks.
+///
+/// The number of request slots may be elastic: if all slots are busy, the pool grows up to an upper bound instead of
+/// backlogging the message, and it shrinks back towards a lower bound if most slots stay idle for a while.
+///
+/// With flow control, at most a fixed number of messages (credits) may be unacknowledged per destination. Messages
+/// to a destination without credits stay in the backlog until the receiver grants new ones (see grant_credits()).
+///
+/// Optionally, recurring sends use persistent requests: if a buffer is sent to the same destination with the same size
+/// again, the send is started from a cached request created with MPI_Send_init instead of issuing a new MPI_Isend.
+///
+/// Optionally, backlogged messages to the same destination are coalesced into a single send when they are started,
+/// up to a maximum message size. The receipts of all coalesced messages are reported once the combined send finishes.
+///
+/// Large messages may be sent in partitions which are released one by one while the caller fills the buffer. With MPI 4
+/// this uses partitioned communication (MPI_Psend_init/MPI_Pready), otherwise the message is sent as a whole once the
+/// last partition is ready.
+///
+/// Messages may also be held until the receiver has fetched them by other means, e.g. remote memory access (see
+/// hold_for_pickup()).
+///
+/// Optionally, messages are sent in synchronous mode (MPI_Issend/MPI_Ssend_init), so a send only finishes once the
+/// receiver has matched it (see set_synchronous_sends()).
 template <MPIBuffer MessageContainer>
 class Sender {
 public:
@@ -42,114 +79,792 @@ public:
         : comm_(comm),
           request_pool_(num_send_slots),
           active_sends_(num_send_slots),
-          send_backlog_capacity_(send_backlog_capacity) {}
+          send_backlog_capacity_(send_backlog_capacity),
+          min_num_send_slots_(num_send_slots),
+          max_num_send_slots_(num_send_slots) {}
+
+    ~Sender() {
+        for (auto& [key, persistent_send] : persistent_sends_) {
+            KASSERT(!persistent_send.active, "The sender must not be destroyed while sends are in flight.");
+            free_persistent_request(persistent_send);
+        }
+    }
+
+    Sender(Sender const&) = delete;
+
+    Sender(Sender&& other) noexcept = default;
+
+    Sender& operator=(Sender const&) = delete;
+
+    Sender& operator=(Sender&& other) noexcept {
+        if (this != &other) {
+            // member-wise assignment would drop our cached persistent requests without freeing them
+            std::destroy_at(this);
+            std::construct_at(this, std::move(other));
+        }
+        return *this;
+    }
 
     std::optional<std::size_t> enqueue_for_sending(MessageContainer&& message, PEID destination, int tag) {
-        drain_send_backlog();  // try to send as many as possible
+        return enqueue(ActiveSend{.receipt = 0, .message = std::move(message), .destination = destination}, tag);
+    }
+
+    /// Send \p message without taking ownership. The memory must stay valid and unmodified until the send with the
+    /// returned receipt has finished, i.e. has been reported by progress_sending(). A callback taking back the
+    /// container gets an empty one for borrowed messages.
+    std::optional<std::size_t> enqueue_borrowed_for_sending(std::span<const value_type> message,
+                                                            PEID destination,
+                                                            int tag)
+        requires std::default_initializable<MessageContainer>
+    {
+        return enqueue(ActiveSend{.receipt = 0, .message = {}, .destination = destination, .borrowed_message = message},
+                       tag);
+    }
 
+    /// Send \p message in \p num_partitions equally sized partitions, each of which is released with
+    /// mark_partition_ready() once the caller has filled it. Like for borrowed messages, the memory must stay valid
+    /// until the returned receipt has been reported by progress_sending().
+    ///
+    /// With partitioned communication, the send is started right away, so the first partitions may be transferred
+    /// while the remaining ones are still being filled. It therefore needs a free request slot and, with flow control,
+    /// a credit for \p destination, partitioned sends are never backlogged. Without partitioned communication, the
+    /// message is enqueued as a whole once all partitions are ready, ignoring the backlog capacity.
+    std::optional<std::size_t> enqueue_partitioned_for_sending(std::span<const value_type> message,
+                                                               PEID destination,
+                                                               int tag,
+                                                               std::size_t num_partitions)
+        requires std::default_initializable<MessageContainer>
+    {
+        KASSERT(num_partitions > 0 && message.size() % num_partitions == 0, "The partitions must have equal size.");
         std::size_t receipt = next_receipt_id_;
-        PendingSend msg{.send = ActiveSend{.receipt = receipt, .message = std::move(message)},
-                        .destination = destination,
-                        .tag = tag};
+        ActiveSend send{.receipt = receipt, .message = {}, .destination = destination, .borrowed_message = message};
+        PartitionedSend partitioned_send{.ready = std::vector<bool>(num_partitions)};
+        if (partitioned_communication_available()) {
+            make_room_for_sending();
+            if (!has_credit(destination)) {
+                return std::nullopt;
+            }
+            auto request = request_pool_.get_some_inactive_request();
+            if (!request.has_value()) {
+                return std::nullopt;
+            }
+            if (flow_control_credits_ > 0) {
+                unacknowledged_sends_[destination]++;
+            }
+#if MPI_VERSION >= 4
+            MPI_Psend_init(message.data(), static_cast<int>(num_partitions),
+                           static_cast<MPI_Count>(message.size() / num_partitions), kamping::mpi_datatype<value_type>(),
+                           destination, tag, comm_, MPI_INFO_NULL, &partitioned_send.request);
+            MPI_Start(&partitioned_send.request);
+#endif
+            // the request pool only borrows the handle, it is freed once the send has finished
+            request->second = partitioned_send.request;
+            send.partitioned = true;
+            active_sends_[request->first] = std::move(send);
+        } else {
+            partitioned_send.pending = PendingSend{.send = std::move(send), .tag = tag};
+            num_pending_partitioned_sends_++;
+        }
+        partitioned_sends_.emplace(receipt, std::move(partitioned_send));
+        outstanding_sends_per_destination_[destination]++;
+        issue_receipt();
+        return receipt;
+    }
 
-        if (request_pool_.inactive_requests() > 0 && send_backlog_.empty()) {
-            // we can send immediatly
+    /// Release \p partition of the partitioned send with the given \p receipt for sending.
+    void mark_partition_ready(std::size_t receipt, std::size_t partition) {
+        auto it = partitioned_sends_.find(receipt);
+        KASSERT(it != partitioned_sends_.end(), "There is no unfinished partitioned send with this receipt.");
+        PartitionedSend& partitioned_send = it->second;
+        KASSERT(partition < partitioned_send.ready.size() && !partitioned_send.ready[partition]);
+        partitioned_send.ready[partition] = true;
+        partitioned_send.num_ready++;
+        if (!partitioned_send.pending.has_value()) {
+#if MPI_VERSION >= 4
+            MPI_Pready(static_cast<int>(partition), partitioned_send.request);
+#endif
+            return;
+        }
+        if (partitioned_send.num_ready < partitioned_send.ready.size()) {
+            return;
+        }
+        // all partitions are filled, so the fallback can send the message as a whole
+        PendingSend msg = std::move(*partitioned_send.pending);
+        partitioned_sends_.erase(it);
+        num_pending_partitioned_sends_--;
+        if (can_send_immediately(msg.send.destination)) {
             auto request = request_pool_.get_some_inactive_request();
             KASSERT(request.has_value(), "There should be inactive requests.");
             start_send(std::move(msg), request->second, request->first);
-        } else if (send_backlog_.size() < send_backlog_capacity_) {
-            // buffer the message
-            send_backlog_.emplace_back(std::move(msg));
         } else {
-            // no room for buffering or sending
-            return std::nullopt;
+            push_to_backlog(std::move(msg));
         }
-        next_receipt_id_++;
-        return receipt;
-    };
+    }
+
+    /// Keep \p message until the receiver has fetched it by itself, instead of sending it. The send finishes when it is
+    /// released with release_pickup(). Like partitioned sends, pickups ignore the backlog capacity and flow control.
+    /// @return the receipt and the data to hand to the receiver
+    auto hold_for_pickup(MessageContainer&& message, PEID destination)
+        -> std::pair<std::size_t, std::span<const value_type>> {
+        return hold(ActiveSend{.receipt = 0, .message = std::move(message), .destination = destination});
+    }
+
+    /// Like hold_for_pickup(), but without taking ownership of \p message, whose memory must stay valid until the
+    /// returned receipt has finished.
+    auto hold_borrowed_for_pickup(std::span<const value_type> message, PEID destination)
+        -> std::pair<std::size_t, std::span<const value_type>>
+        requires std::default_initializable<MessageContainer>
+    {
+        return hold(ActiveSend{.receipt = 0, .message = {}, .destination = destination, .borrowed_message = message});
+    }
+
+    /// Finish the held message with the given \p receipt, as the receiver has fetched it, and report it to
+    /// \p on_finished_sending.
+    void release_pickup(std::size_t receipt, SendFinishedCallback<MessageContainer> auto&& on_finished_sending) {
+        auto it = held_sends_.find(receipt);
+        KASSERT(it != held_sends_.end(), "There is no held message with this receipt.");
+        MessageContainer buffer = std::move(it->second.message);
+        finish_send(it->second.destination);
+        // held receipts are not part of the receipt window, they finish by leaving held_sends_
+        held_sends_.erase(it);
+        if constexpr (std::invocable<decltype(on_finished_sending), std::size_t, MessageContainer>) {
+            on_finished_sending(receipt, std::move(buffer));
+        } else {
+            on_finished_sending(receipt);
+        }
+    }
 
     auto progress_sending(SendFinishedCallback<MessageContainer> auto&& on_finished_sending) {
-        constexpr bool move_back_buffer = std::invocable<decltype(on_finished_sending), std::size_t, MessageContainer>;
         // check for finished sends and try starting new ones
-        bool any_completed = request_pool_.test_any([&](int completed_request_index) {
-            std::optional<ActiveSend>& completed_send = active_sends_[completed_request_index];
-            KASSERT(completed_send.has_value());
-            std::size_t receipt = completed_send->receipt;
-            MessageContainer buffer = std::move(completed_send->message);
-            completed_send.reset();
-            if constexpr (move_back_buffer) {
-                on_finished_sending(receipt, std::move(buffer));
-            } else {
-                on_finished_sending(receipt);
-            }
-            if (!send_backlog_.empty()) {
-                auto request = request_pool_.get_some_inactive_request(completed_request_index);
-                KASSERT(request.has_value(), "We just completed a send, so the slot we hinted should be free.");
-                start_send(std::move(send_backlog_.front()), request->second, request->first);
-                send_backlog_.pop_front();
-            }
-        });
+        auto finish = [&](int completed_request_index) {
+            finish_completed_send(completed_request_index, on_finished_sending);
+        };
+        bool completed_some = retire_all_completed_sends_ ? request_pool_.test_some(finish, completion_strategy_) > 0
+                                                          : request_pool_.test_any(finish, completion_strategy_);
+        // like MPI_Testany, report completion if there is nothing in flight, so callers waiting for a free slot do not
+        // block forever
+        bool any_completed = completed_some || request_pool_.active_requests() == 0;
+        if (min_num_send_slots_ < max_num_send_slots_) {
+            shrink_idle_send_slots();
+        }
         // fill the remaining slots if possible
         drain_send_backlog();
         return any_completed;
     };
 
+    /// @return the requests of all send slots, so that they can be waited on along with other requests
+    [[nodiscard]] std::span<MPI_Request const> send_requests() const {
+        return request_pool_.all_requests();
+    }
+
+    /// Finish the sends in \p slots, whose requests have been completed by waiting on a copy of send_requests(), and
+    /// start backlogged sends in the freed slots.
+    void handle_completed_sends(std::span<const int> slots,
+                                SendFinishedCallback<MessageContainer> auto&& on_finished_sending) {
+        for (int slot : slots) {
+            request_pool_.release_completed(slot);
+            finish_completed_send(slot, on_finished_sending);
+        }
+        drain_send_backlog();
+    }
+
+    /// Select which request slots are tested for completion in progress_sending().
+    void set_completion_strategy(CompletionStrategy completion_strategy) {
+        completion_strategy_ = completion_strategy;
+    }
+
+    /// Retire all completed sends per call to progress_sending() (MPI_Testsome, the default), or at most one
+    /// (MPI_Testany).
+    void set_retire_all_completed_sends(bool retire_all = true) {
+        retire_all_completed_sends_ = retire_all;
+    }
+
     /// Adjust the send backlog capacity at runtime. Only ever grown by the indirection adapter; shrinking below the
     /// current backlog size is harmless (no further messages are buffered until it drains below the new cap).
     void set_send_backlog_capacity(std::size_t send_backlog_capacity) {
         send_backlog_capacity_ = send_backlog_capacity;
     }
 
+    /// Limit the number of backlogged messages per destination (unbounded by default). Like the total capacity, this
+    /// may be changed at any time, a backlog exceeding the new limit is drained as usual.
+    void set_send_backlog_capacity_per_destination(std::size_t send_backlog_capacity_per_destination) {
+        send_backlog_capacity_per_destination_ = send_backlog_capacity_per_destination;
+    }
+
+    /// Coalesce backlogged messages to the same destination (and with the same tag) into a single send, as long as the
+    /// combined message has at most \p max_message_size elements. 0 disables coalescing. The receiver gets the
+    /// concatenation of the messages, so this is only useful if message boundaries can be recovered from the content,
+    /// e.g. for aggregation buffers. Borrowed and partitioned messages are never coalesced.
+    void set_coalescing_limit(std::size_t max_message_size) {
+        coalescing_limit_ = max_message_size;
+    }
+
+    /// @return the number of messages which have been coalesced into another send since the last call
+    std::size_t take_num_coalesced_sends() {
+        return std::exchange(num_coalesced_sends_, 0);
+    }
+
+    /// Send in synchronous mode, so that no outstanding sends means all sent messages have been matched by their
+    /// receivers. This may only change while no messages are outstanding.
+    void set_synchronous_sends(bool synchronous = true) {
+        if (synchronous == synchronous_sends_) {
+            return;
+        }
+        KASSERT(outstanding_sends() == 0, "The send mode cannot change while messages are outstanding.");
+        // the cached persistent requests have been created for the other mode
+        while (evict_persistent_send()) {
+        }
+        synchronous_sends_ = synchronous;
+    }
+
+    /// Start no sends while paused, new messages are backlogged as far as the capacity allows. This keeps a termination
+    /// counting round consistent (see TerminationDetection::single_round).
+    void pause_sending(bool pause = true) {
+        sending_paused_ = pause;
+        if (!sending_paused_) {
+            drain_send_backlog();
+        }
+    }
+
+    [[nodiscard]] bool sending_paused() const {
+        return sending_paused_;
+    }
+
+    /// Use persistent requests for recurring (buffer, destination) pairings, caching at most \p cache_capacity of them.
+    /// A capacity of 0 disables persistent sends.
+    /// @return the number of sends which have been started from a cached persistent request
+    [[nodiscard]] std::size_t num_persistent_sends() const {
+        return num_persistent_sends_;
+    }
+
+    void set_persistent_send_cache_capacity(std::size_t cache_capacity) {
+        persistent_send_cache_capacity_ = cache_capacity;
+        while (persistent_sends_.size() > persistent_send_cache_capacity_ && evict_persistent_send()) {
+        }
+    }
+
+    /// Let the number of request slots vary between \p min_num_send_slots and \p max_num_send_slots. The current number
+    /// of slots is clamped to the new bounds (as far as no active slots have to be dropped).
+    void set_send_slot_bounds(std::size_t min_num_send_slots, std::size_t max_num_send_slots) {
+        KASSERT(0 < min_num_send_slots && min_num_send_slots <= max_num_send_slots);
+        min_num_send_slots_ = min_num_send_slots;
+        max_num_send_slots_ = max_num_send_slots;
+        resize_send_slots(std::clamp(num_send_slots(), min_num_send_slots_, max_num_send_slots_));
+    }
+
+    [[nodiscard]] std::size_t num_send_slots() const {
+        return request_pool_.capacity();
+    }
+
     [[nodiscard]] bool has_capacity() const {
         if (send_backlog_capacity_ == std::numeric_limits<std::size_t>::max()) {
             return true;
         }
-        return send_backlog_.size() < send_backlog_capacity_ || request_pool_.inactive_requests() > 0;
+        if (sending_paused_) {
+            return send_backlog_size_ < send_backlog_capacity_;
+        }
+        return send_backlog_size_ < send_backlog_capacity_ || request_pool_.inactive_requests() > 0 ||
+               num_growable_send_slots() > 0;
+    }
+
+    /// @return true if a message to \p destination would currently be accepted by enqueue_for_sending()
+    [[nodiscard]] bool has_capacity(PEID destination) const {
+        std::size_t free_slots = request_pool_.inactive_requests() + num_growable_send_slots();
+        if (!sending_paused_ && backlog_size(destination) == 0 && has_credit(destination) &&
+            free_slots > send_backlog_size_) {
+            // sent right away, even if draining the backlog takes all other slots
+            return true;
+        }
+        if (backlog_size(destination) >= send_backlog_capacity_per_destination_) {
+            return false;
+        }
+        if (send_backlog_capacity_ == std::numeric_limits<std::size_t>::max()) {
+            return true;
+        }
+        // backlogged, if there is room or draining the backlog makes some
+        return send_backlog_size_ < send_backlog_capacity_ ||
+               (!sending_paused_ && free_slots > 0 && !ready_destinations_.empty());
+    }
+
+    /// Allow at most \p credits unacknowledged messages per destination; 0 disables flow control. This has to be set
+    /// before the first message is sent.
+    void set_flow_control_credits(std::size_t credits) {
+        KASSERT(outstanding_sends() == 0 && unacknowledged_sends_.empty());
+        flow_control_credits_ = credits;
+    }
+
+    [[nodiscard]] std::size_t flow_control_credits() const {
+        return flow_control_credits_;
+    }
+
+    /// The receiver \p destination has consumed \p credits of our messages, so we may send as many new ones.
+    void grant_credits(PEID destination, std::size_t credits) {
+        auto it = unacknowledged_sends_.find(destination);
+        KASSERT(it != unacknowledged_sends_.end() && it->second >= credits,
+                "Cannot be granted credits for more messages than we sent.");
+        bool had_credit = has_credit(destination);
+        it->second -= credits;
+        if (it->second == 0) {
+            unacknowledged_sends_.erase(it);
+        }
+        if (!had_credit && backlog_size(destination) > 0) {
+            // the destination was blocked, so it is not in the round-robin queue yet
+            ready_destinations_.push_back(destination);
+        }
+        drain_send_backlog();
+    }
+
+    /// @return true if the send with the given \p receipt has finished, i.e. its buffer may be reused
+    [[nodiscard]] bool has_finished(std::size_t receipt) const {
+        KASSERT(receipt < next_receipt_id_, "This receipt has not been issued yet.");
+        if (held_sends_.contains(receipt)) {
+            return false;
+        }
+        return receipt < oldest_unfinished_receipt_ ||
+               !unfinished_receipts_[receipt & (unfinished_receipts_.size() - 1)];
     }
 
     [[nodiscard]] std::size_t outstanding_sends() const {
-        return send_backlog_.size() + request_pool_.active_requests();
+        return send_backlog_size_ + request_pool_.active_requests() + num_pending_partitioned_sends_ +
+               held_sends_.size();
+    }
+
+    /// @return the number of messages to \p destination which are backlogged or in flight
+    [[nodiscard]] std::size_t outstanding_sends(PEID destination) const {
+        auto it = outstanding_sends_per_destination_.find(destination);
+        if (it == outstanding_sends_per_destination_.end()) {
+            return 0;
+        }
+        return it->second;
     }
 
 private:
+    /// Release the buffer of the completed send in slot \p completed_request_index and report it (and the messages
+    /// coalesced into it) as finished. A backlogged send takes over the slot right away.
+    void finish_completed_send(int completed_request_index,
+                               SendFinishedCallback<MessageContainer> auto&& on_finished_sending) {
+        constexpr bool move_back_buffer = std::invocable<decltype(on_finished_sending), std::size_t, MessageContainer>;
+        std::optional<ActiveSend>& completed_send = active_sends_[completed_request_index];
+        KASSERT(completed_send.has_value());
+        std::size_t receipt = completed_send->receipt;
+        if (completed_send->partitioned) {
+            finish_partitioned_send(receipt);
+        } else if (persistent_send_cache_capacity_ > 0) {
+            finish_persistent_send(*completed_send);
+        }
+        MessageContainer buffer = std::move(completed_send->message);
+        std::vector<CoalescedSend> coalesced_sends = std::move(completed_send->coalesced_sends);
+        finish_send(completed_send->destination);
+        for (std::size_t i = 0; i < coalesced_sends.size(); i++) {
+            finish_send(completed_send->destination);
+        }
+        completed_send.reset();
+        mark_finished(receipt);
+        for (auto const& coalesced_send : coalesced_sends) {
+            mark_finished(coalesced_send.receipt);
+        }
+        if constexpr (move_back_buffer) {
+            on_finished_sending(receipt, std::move(buffer));
+            for (auto& coalesced_send : coalesced_sends) {
+                on_finished_sending(coalesced_send.receipt, std::move(coalesced_send.message));
+            }
+        } else {
+            on_finished_sending(receipt);
+            for (auto const& coalesced_send : coalesced_sends) {
+                on_finished_sending(coalesced_send.receipt);
+            }
+        }
+        if (!ready_destinations_.empty()) {
+            auto request = request_pool_.get_some_inactive_request(completed_request_index);
+            KASSERT(request.has_value(), "We just completed a send, so the slot we hinted should be free.");
+            start_next_pending_send(request->second, request->first);
+        }
+    }
+
+    struct CoalescedSend {
+        std::size_t receipt;
+        MessageContainer message;
+    };
     struct ActiveSend {
         std::size_t receipt;
         MessageContainer message;
+        PEID destination;
+        std::optional<std::span<const value_type>> borrowed_message = std::nullopt;
+        bool partitioned = false;
+        std::vector<CoalescedSend> coalesced_sends = {};  // appended to this message, finished along with it
+
+        /// @return the data to send, which is either owned or borrowed
+        [[nodiscard]] std::span<const value_type> payload() const {
+            if (borrowed_message.has_value()) {
+                return *borrowed_message;
+            }
+            return std::span<const value_type>(message);
+        }
     };
     struct PendingSend {
         ActiveSend send;
+        int tag;
+    };
+    struct PersistentSendKey {
+        value_type const* data;
         PEID destination;
+        bool operator==(PersistentSendKey const&) const = default;
+    };
+    struct PersistentSendKeyHash {
+        std::size_t operator()(PersistentSendKey const& key) const noexcept {
+            return std::hash<value_type const*>{}(key.data) ^ (std::hash<PEID>{}(key.destination) << 1);
+        }
+    };
+    struct PersistentSend {
+        std::size_t count;
         int tag;
+        MPI_Request request = MPI_REQUEST_NULL;  // only initialized once the pairing is seen a second time
+        bool active = false;
     };
+    struct PartitionedSend {
+        std::optional<PendingSend> pending = std::nullopt;  // without partitioned communication, until all are ready
+        MPI_Request request = MPI_REQUEST_NULL;
+        std::vector<bool> ready;
+        std::size_t num_ready = 0;
+    };
+
+    std::optional<std::size_t> enqueue(ActiveSend&& send, int tag) {
+        PEID destination = send.destination;
+        make_room_for_sending();
+
+        std::size_t receipt = next_receipt_id_;
+        send.receipt = receipt;
+        PendingSend msg{.send = std::move(send), .tag = tag};
+
+        if (can_send_immediately(destination)) {
+            auto request = request_pool_.get_some_inactive_request();
+            KASSERT(request.has_value(), "There should be inactive requests.");
+            start_send(std::move(msg), request->second, request->first);
+        } else if (send_backlog_size_ < send_backlog_capacity_ &&
+                   backlog_size(destination) < send_backlog_capacity_per_destination_) {
+            push_to_backlog(std::move(msg));
+        } else {
+            // no room for buffering or sending
+            return std::nullopt;
+        }
+        outstanding_sends_per_destination_[destination]++;
+        issue_receipt();
+        return receipt;
+    }
+
+    auto hold(ActiveSend&& send) -> std::pair<std::size_t, std::span<const value_type>> {
+        std::size_t receipt = next_receipt_id_;
+        send.receipt = receipt;
+        outstanding_sends_per_destination_[send.destination]++;
+        // a held message may stay unfinished for long, so it must not hold back the receipt window
+        issue_receipt(/*tracked=*/false);
+        // map nodes are stable, so the payload stays valid until the send is released
+        auto it = held_sends_.emplace(receipt, std::move(send)).first;
+        return {receipt, it->second.payload()};
+    }
+
+    /// Start backlogged sends and add request slots if all are busy.
+    void make_room_for_sending() {
+        drain_send_backlog();  // try to send as many as possible
+        while (request_pool_.inactive_requests() == 0 && num_send_slots() < max_num_send_slots_) {
+            // all slots are busy, rather add slots than backlogging the message
+            resize_send_slots(std::min(max_num_send_slots_, 2 * num_send_slots()));
+            drain_send_backlog();
+        }
+    }
+
+    [[nodiscard]] bool can_send_immediately(PEID destination) const {
+        return !sending_paused_ && request_pool_.inactive_requests() > 0 && backlog_size(destination) == 0 &&
+               has_credit(destination);
+    }
+
+    void push_to_backlog(PendingSend&& msg) {
+        PEID destination = msg.send.destination;
+        auto& backlog = send_backlogs_[destination];
+        if (backlog.empty() && has_credit(destination)) {
+            ready_destinations_.push_back(destination);
+        }
+        backlog.emplace_back(std::move(msg));
+        send_backlog_size_++;
+    }
 
     void start_send(PendingSend&& msg,  // NOLINT(cppcoreguidelines-rvalue-reference-param-not-moved)
                     MPI_Request& request,
                     std::size_t request_index) {
         auto& active_send = active_sends_[request_index];
         active_send = std::move(msg.send);
+        if (flow_control_credits_ > 0) {
+            unacknowledged_sends_[active_send->destination]++;
+        }
+        if (persistent_send_cache_capacity_ > 0 && start_persistent_send(*active_send, msg.tag, request)) {
+            return;
+        }
+#if MPI_VERSION >= 4
+        auto isend = synchronous_sends_ ? MPI_Issend_c : MPI_Isend_c;
+        isend(active_send->payload().data(), active_send->payload().size(), kamping::mpi_datatype<value_type>(),
+              active_send->destination, msg.tag, comm_, &request);
+#else
+        auto isend = synchronous_sends_ ? MPI_Issend : MPI_Isend;
+        isend(active_send->payload().data(), static_cast<int>(active_send->payload().size()),
+              kamping::mpi_datatype<value_type>(), active_send->destination, msg.tag, comm_, &request);
+#endif
+    }
+
+    /// Start \p send from a cached persistent request if this (buffer, destination) pairing has been sent with the same
+    /// size and tag before.
+    /// @return false if the caller has to fall back to MPI_Isend
+    bool start_persistent_send(ActiveSend const& send, int tag, MPI_Request& request) {
+        if (send.payload().size() == 0) {
+            return false;
+        }
+        PersistentSendKey key{.data = send.payload().data(), .destination = send.destination};
+        auto it = persistent_sends_.find(key);
+        if (it == persistent_sends_.end()) {
+            // first time we see this pairing, remember it for the next send
+            if (persistent_sends_.size() >= persistent_send_cache_capacity_ && !evict_persistent_send()) {
+                return false;
+            }
+            persistent_sends_.emplace(key, PersistentSend{.count = send.payload().size(), .tag = tag});
+            return false;
+        }
+        PersistentSend& persistent_send = it->second;
+        KASSERT(!persistent_send.active, "A buffer cannot be in flight twice.");
+        if (persistent_send.count != send.payload().size() || persistent_send.tag != tag) {
+            // the pairing changed, the cached request no longer matches
+            free_persistent_request(persistent_send);
+            persistent_send.count = send.payload().size();
+            persistent_send.tag = tag;
+            return false;
+        }
+        if (persistent_send.request == MPI_REQUEST_NULL) {
 #if MPI_VERSION >= 4
-        MPI_Isend_c(active_send->message.data(), active_send->message.size(),
-                    kamping::mpi_datatype<value_type>(), msg.destination, msg.tag, comm_, &request);
+            auto send_init = synchronous_sends_ ? MPI_Ssend_init_c : MPI_Send_init_c;
+            send_init(send.payload().data(), send.payload().size(), kamping::mpi_datatype<value_type>(),
+                      send.destination, tag, comm_, &persistent_send.request);
 #else
-        MPI_Isend(active_send->message.data(), static_cast<int>(active_send->message.size()),
-                  kamping::mpi_datatype<value_type>(), msg.destination, msg.tag, comm_, &request);
+            auto send_init = synchronous_sends_ ? MPI_Ssend_init : MPI_Send_init;
+            send_init(send.payload().data(), static_cast<int>(send.payload().size()),
+                      kamping::mpi_datatype<value_type>(), send.destination, tag, comm_, &persistent_send.request);
 #endif
+        }
+        MPI_Start(&persistent_send.request);
+        persistent_send.active = true;
+        num_persistent_sends_++;
+        // the request pool only borrows the handle, the cache keeps ownership
+        request = persistent_send.request;
+        return true;
+    }
+
+    void finish_persistent_send(ActiveSend const& send) {
+        if (send.payload().size() == 0) {
+            return;
+        }
+        auto it =
+            persistent_sends_.find(PersistentSendKey{.data = send.payload().data(), .destination = send.destination});
+        if (it != persistent_sends_.end()) {
+            it->second.active = false;
+        }
+    }
+
+    void finish_partitioned_send(std::size_t receipt) {
+        auto it = partitioned_sends_.find(receipt);
+        KASSERT(it != partitioned_sends_.end());
+        MPI_Request_free(&it->second.request);
+        partitioned_sends_.erase(it);
+    }
+
+    /// Drop some cached pairing which is not in flight.
+    /// @return false if all cached requests are in flight
+    bool evict_persistent_send() {
+        auto it = std::ranges::find_if(persistent_sends_, [](auto const& entry) { return !entry.second.active; });
+        if (it == persistent_sends_.end()) {
+            return false;
+        }
+        free_persistent_request(it->second);
+        persistent_sends_.erase(it);
+        return true;
+    }
+
+    static void free_persistent_request(PersistentSend& persistent_send) {
+        if (persistent_send.request != MPI_REQUEST_NULL) {
+            MPI_Request_free(&persistent_send.request);
+        }
+    }
+
+    /// Start the oldest backlogged message of the next destination in round-robin order.
+    void start_next_pending_send(MPI_Request& request, std::size_t request_index) {
+        KASSERT(!ready_destinations_.empty());
+        PEID destination = ready_destinations_.front();
+        ready_destinations_.pop_front();
+        auto it = send_backlogs_.find(destination);
+        KASSERT(it != send_backlogs_.end() && !it->second.empty());
+        auto& backlog = it->second;
+        PendingSend msg = std::move(backlog.front());
+        backlog.pop_front();
+        send_backlog_size_--;
+        if constexpr (std::ranges::range<MessageContainer> &&
+                      requires(MessageContainer& message, MessageContainer const& other) {
+                          message.insert(message.end(), other.begin(), other.end());
+                      }) {
+            if (coalescing_limit_ > 0) {
+                coalesce(msg, backlog);
+            }
+        }
+        start_send(std::move(msg), request, request_index);
+        if (backlog.empty()) {
+            send_backlogs_.erase(it);
+        } else if (has_credit(destination)) {
+            ready_destinations_.push_back(destination);
+        }
+    }
+
+    /// Append the following messages in \p backlog to \p msg, as long as the result stays within the coalescing
+    /// limit.
+    void coalesce(PendingSend& msg, std::deque<PendingSend>& backlog) {
+        auto is_coalescable = [&](PendingSend const& pending) {
+            return !pending.send.borrowed_message.has_value() && pending.tag == msg.tag;
+        };
+        if (!is_coalescable(msg)) {
+            return;
+        }
+        MessageContainer& message = msg.send.message;
+        while (!backlog.empty() && is_coalescable(backlog.front()) &&
+               message.size() + backlog.front().send.message.size() <= coalescing_limit_) {
+            ActiveSend& next = backlog.front().send;
+            message.insert(message.end(), next.message.begin(), next.message.end());
+            msg.send.coalesced_sends.push_back(
+                CoalescedSend{.receipt = next.receipt, .message = std::move(next.message)});
+            backlog.pop_front();
+            send_backlog_size_--;
+            num_coalesced_sends_++;
+        }
     }
 
     void drain_send_backlog() {
-        while (!send_backlog_.empty() && request_pool_.inactive_requests() > 0) {
+        while (!sending_paused_ && !ready_destinations_.empty() && request_pool_.inactive_requests() > 0) {
             auto request = request_pool_.get_some_inactive_request();
             KASSERT(request.has_value(), "There should be some inactive request.");
-            start_send(std::move(send_backlog_.front()), request->second, request->first);
-            send_backlog_.pop_front();
+            start_next_pending_send(request->second, request->first);
+        }
+    }
+
+    [[nodiscard]] std::size_t num_growable_send_slots() const {
+        // the pool may exceed the upper bound if it could not shrink because of active slots
+        return max_num_send_slots_ > num_send_slots() ? max_num_send_slots_ - num_send_slots() : 0;
+    }
+
+    void resize_send_slots(std::size_t new_num_send_slots) {
+        // active sends occupy the same indices as their request slots
+        active_sends_.resize(request_pool_.resize(new_num_send_slots));
+        peak_active_send_slots_ = request_pool_.active_requests();
+        progress_calls_since_resize_ = 0;
+    }
+
+    /// Halve the number of slots if at most a quarter of them has been in use during the last
+    /// SEND_SLOT_SHRINK_INTERVAL calls to progress_sending().
+    void shrink_idle_send_slots() {
+        peak_active_send_slots_ = std::max(peak_active_send_slots_, request_pool_.active_requests());
+        if (++progress_calls_since_resize_ < SEND_SLOT_SHRINK_INTERVAL) {
+            return;
+        }
+        if (4 * peak_active_send_slots_ <= num_send_slots() && num_send_slots() > min_num_send_slots_) {
+            resize_send_slots(std::max(min_num_send_slots_, num_send_slots() / 2));
+        } else {
+            peak_active_send_slots_ = request_pool_.active_requests();
+            progress_calls_since_resize_ = 0;
+        }
+    }
+
+    /// Issue the receipt next_receipt_id_. Untracked receipts do not occupy the window, they are finished as soon as
+    /// they are issued, as far as the window is concerned.
+    void issue_receipt(bool tracked = true) {
+        if (next_receipt_id_ - oldest_unfinished_receipt_ == unfinished_receipts_.size()) {
+            grow_receipt_window();
+        }
+        unfinished_receipts_[next_receipt_id_ & (unfinished_receipts_.size() - 1)] = tracked;
+        next_receipt_id_++;
+        advance_oldest_unfinished_receipt();
+    }
+
+    void mark_finished(std::size_t receipt) {
+        KASSERT(receipt >= oldest_unfinished_receipt_ &&
+                    unfinished_receipts_[receipt & (unfinished_receipts_.size() - 1)],
+                "A receipt can only finish once.");
+        unfinished_receipts_[receipt & (unfinished_receipts_.size() - 1)] = false;
+        advance_oldest_unfinished_receipt();
+    }
+
+    void advance_oldest_unfinished_receipt() {
+        while (oldest_unfinished_receipt_ < next_receipt_id_ &&
+               !unfinished_receipts_[oldest_unfinished_receipt_ & (unfinished_receipts_.size() - 1)]) {
+            oldest_unfinished_receipt_++;
+        }
+    }
+
+    /// Double the receipt window, keeping each receipt at its position modulo the new size.
+    void grow_receipt_window() {
+        std::vector<bool> window(std::max(MIN_RECEIPT_WINDOW_SIZE, 2 * unfinished_receipts_.size()));
+        for (std::size_t receipt = oldest_unfinished_receipt_; receipt < next_receipt_id_; receipt++) {
+            window[receipt & (window.size() - 1)] = unfinished_receipts_[receipt & (unfinished_receipts_.size() - 1)];
+        }
+        unfinished_receipts_ = std::move(window);
+    }
+
+    void finish_send(PEID destination) {
+        auto it = outstanding_sends_per_destination_.find(destination);
+        KASSERT(it != outstanding_sends_per_destination_.end() && it->second > 0);
+        if (--it->second == 0) {
+            outstanding_sends_per_destination_.erase(it);
+        }
+    }
+
+    [[nodiscard]] bool has_credit(PEID destination) const {
+        if (flow_control_credits_ == 0) {
+            return true;
+        }
+        auto it = unacknowledged_sends_.find(destination);
+        return it == unacknowledged_sends_.end() || it->second < flow_control_credits_;
+    }
+
+    [[nodiscard]] std::size_t backlog_size(PEID destination) const {
+        auto it = send_backlogs_.find(destination);
+        if (it == send_backlogs_.end()) {
+            return 0;
         }
+        return it->second.size();
     }
 
     MPI_Comm comm_;
     internal::RequestPool request_pool_;
     std::vector<std::optional<ActiveSend>> active_sends_;
-    std::deque<PendingSend> send_backlog_;
+    std::unordered_map<PEID, std::deque<PendingSend>> send_backlogs_;
+    std::deque<PEID> ready_destinations_;  // destinations with a non-empty backlog and credits, in round-robin order
+    std::unordered_map<PEID, std::size_t> outstanding_sends_per_destination_;
+    std::size_t send_backlog_size_ = 0;
     std::size_t send_backlog_capacity_;
-    int next_receipt_id_ = 0;
+    std::size_t send_backlog_capacity_per_destination_ = std::numeric_limits<std::size_t>::max();
+    CompletionStrategy completion_strategy_ = CompletionStrategy::all;
+    bool retire_all_completed_sends_ = true;
+    std::unordered_map<PersistentSendKey, PersistentSend, PersistentSendKeyHash> persistent_sends_;
+    std::size_t persistent_send_cache_capacity_ = 0;
+    std::size_t num_persistent_sends_ = 0;  // started from a cached request
+    bool synchronous_sends_ = false;
+    bool sending_paused_ = false;
+    std::size_t coalescing_limit_ = 0;
+    std::size_t num_coalesced_sends_ = 0;
+    std::unordered_map<std::size_t, PartitionedSend> partitioned_sends_;  // by receipt, until finished
+    std::size_t num_pending_partitioned_sends_ = 0;  // waiting for partitions without partitioned communication
+    std::unordered_map<std::size_t, ActiveSend> held_sends_;  // by receipt, until the receiver has fetched them
+    std::size_t flow_control_credits_ = 0;
+    std::unordered_map<PEID, std::size_t> unacknowledged_sends_;
+    std::size_t min_num_send_slots_;
+    std::size_t max_num_send_slots_;
+    std::size_t peak_active_send_slots_ = 0;
+    std::size_t progress_calls_since_resize_ = 0;
+    std::size_t next_receipt_id_ = 0;
+    std::size_t oldest_unfinished_receipt_ = 0;  // all receipts below have finished, unless they are held
+    // ring buffer flagging the unfinished receipts from oldest_unfinished_receipt_ on, its size is a power of two and
+    // only grows if more receipts than that are pending, so issuing and finishing receipts does not allocate
+    std::vector<bool> unfinished_receipts_;
 };
 }  // namespace briefkasten
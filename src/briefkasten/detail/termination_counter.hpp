@@ -21,10 +21,36 @@
 
 #include <mpi.h>
 #include <cstddef>
+#include <cstdint>
 #include <kamping/mpi_datatype.hpp>
+#include <kassert/kassert.hpp>
 #include <limits>
+#include <utility>
 
-namespace briefkasten::internal {
+namespace briefkasten {
+
+/// How a queue detects that all ranks are done.
+///
+/// double_counting sums up the sent and received messages of all ranks in rounds of MPI_Iallreduce, until two
+/// consecutive rounds agree and all sent messages have been received. This takes at least two rounds.
+///
+/// single_round counts like double_counting, but a rank starts no sends while its counting round is in flight. A
+/// message received before the receiver's count then has been sent before the sender's count, so equal sums mean that
+/// nothing is in flight, and a single round suffices. Messages posted in the meantime, e.g. by the message handlers,
+/// are backlogged until the round has finished.
+///
+/// nbx uses the non-blocking consensus algorithm: messages are sent in synchronous mode, and once all of its sends have
+/// been matched, a rank enters MPI_Ibarrier. The barrier completes after all messages have been matched, so a single
+/// collective suffices. This only works if no messages are sent after entering the barrier, i.e. for synchronous mode
+/// without messages sent by the message handlers.
+///
+/// Both single_round and nbx require that all messages are data messages, i.e. no flow control, RMA rendezvous or
+/// partitioned communication, as the control messages of these cannot wait for the round to finish. Queues fall back
+/// to double_counting otherwise, which is decided by their configuration, so that all ranks agree on the collectives.
+/// For the same reason, queues do not resize their receive buffers while single_round or nbx is in effect.
+enum class TerminationDetection : std::uint8_t { double_counting, single_round, nbx };
+
+namespace internal {
 
 struct MessageCounter {
     size_t send;
@@ -32,10 +58,103 @@ struct MessageCounter {
     auto operator<=>(const MessageCounter&) const = default;
 };
 
+/// Counts the sent and received messages of all ranks in rounds of non-blocking collectives.
+///
+/// The counts are either reduced over the whole communicator at once, or hierarchically (see
+/// enable_hierarchical_counting()): first within each node, then among one leader per node, and finally the result is
+/// broadcast within each node. Each of these stages is started once the previous one has completed, so a round may
+/// take several requests (see message_counting_request()).
+///
+/// The counts can be reset to start a new epoch (see begin_epoch()), so that the counter can be reused after
+/// termination.
 class TerminationCounter {
 public:
     TerminationCounter(MPI_Comm comm) : comm_(comm) {}
 
+    ~TerminationCounter() {
+        if (node_comm_ != MPI_COMM_NULL) {
+            MPI_Comm_free(&node_comm_);
+        }
+        if (leader_comm_ != MPI_COMM_NULL) {
+            MPI_Comm_free(&leader_comm_);
+        }
+    }
+
+    TerminationCounter(TerminationCounter const&) = delete;
+
+    TerminationCounter(TerminationCounter&& other) noexcept
+        : comm_(other.comm_),
+          node_comm_(std::exchange(other.node_comm_, MPI_COMM_NULL)),
+          leader_comm_(std::exchange(other.leader_comm_, MPI_COMM_NULL)),
+          node_rank_(other.node_rank_),
+          reduce_req_(std::exchange(other.reduce_req_, MPI_REQUEST_NULL)),
+          epoch_req_(std::exchange(other.epoch_req_, MPI_REQUEST_NULL)),
+          stage_(other.stage_),
+          local_(other.local_),
+          num_termination_rounds_(other.num_termination_rounds_),
+          in_barrier_(other.in_barrier_),
+          single_round_(other.single_round_),
+          global_(other.global_),
+          previous_global_(other.previous_global_) {}
+
+    TerminationCounter& operator=(TerminationCounter const&) = delete;
+    /// Swaps the node communicators, so the ones of this counter are freed along with \p other.
+    TerminationCounter& operator=(TerminationCounter&& other) noexcept {
+        std::swap(comm_, other.comm_);
+        std::swap(node_comm_, other.node_comm_);
+        std::swap(leader_comm_, other.leader_comm_);
+        node_rank_ = other.node_rank_;
+        std::swap(reduce_req_, other.reduce_req_);
+        std::swap(epoch_req_, other.epoch_req_);
+        stage_ = other.stage_;
+        local_ = other.local_;
+        num_termination_rounds_ = other.num_termination_rounds_;
+        in_barrier_ = other.in_barrier_;
+        single_round_ = other.single_round_;
+        global_ = other.global_;
+        previous_global_ = other.previous_global_;
+        return *this;
+    }
+
+    /// Reduce the counts within each node first, so that only one leader per node takes part in the reduction over all
+    /// nodes. This is collective.
+    void enable_hierarchical_counting() {
+        if (node_comm_ != MPI_COMM_NULL) {
+            return;
+        }
+        int rank = 0;
+        MPI_Comm_rank(comm_, &rank);
+        MPI_Comm_split_type(comm_, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL, &node_comm_);
+        MPI_Comm_rank(node_comm_, &node_rank_);
+        MPI_Comm_split(comm_, node_rank_ == 0 ? 0 : MPI_UNDEFINED, rank, &leader_comm_);
+    }
+
+    /// Reset the counts after termination, and enter a non-blocking barrier which separates the epochs: a message of
+    /// the new epoch may only be sent once epoch_started() holds, i.e. after all ranks have left the previous one.
+    /// Otherwise, it could be received, and counted, by a rank which has not yet noticed the previous termination.
+    /// This is collective.
+    void begin_epoch() {
+        KASSERT(reduce_req_ == MPI_REQUEST_NULL, "A new epoch cannot begin during a counting round.");
+        KASSERT(epoch_req_ == MPI_REQUEST_NULL, "The previous epoch has not yet started on all ranks.");
+        local_ = {.send = 0, .receive = 0};
+        global_ = {.send = 0, .receive = 0};
+        previous_global_ = NO_PREVIOUS_COUNT;
+        stage_ = CountingStage::last;
+        in_barrier_ = false;
+        single_round_ = false;
+        MPI_Ibarrier(comm_, &epoch_req_);
+    }
+
+    /// @return true if all ranks have begun the current epoch
+    [[nodiscard]] bool epoch_started() {
+        if (epoch_req_ == MPI_REQUEST_NULL) {
+            return true;
+        }
+        int barrier_finished = 0;
+        MPI_Test(&epoch_req_, &barrier_finished, MPI_STATUS_IGNORE);
+        return barrier_finished != 0;
+    }
+
     void track_send() {
         local_.send++;
     }
@@ -44,6 +163,13 @@ public:
         local_.receive++;
     }
 
+    /// \p num_sends messages have been appended to another message to the same receiver before being sent, so they
+    /// will never be received on their own. We count them as received right away, which keeps both counters
+    /// monotonic. Termination is still delayed until the combined message has been received.
+    void track_coalesced_sends(std::size_t num_sends) {
+        local_.receive += num_sends;
+    }
+
     /// Snapshot of the locally tracked send/receive counts. Used to fold a sibling queue's counts into a single
     /// joint termination round (see IndirectionAdapter), so the whole multi-hop system is counted in one allreduce.
     [[nodiscard]] MessageCounter local_counts() const {
@@ -53,8 +179,34 @@ public:
     void start_message_counting(MessageCounter additional = {.send = 0, .receive = 0}) {
         if (reduce_req_ == MPI_REQUEST_NULL) {
             global_ = {.send = local_.send + additional.send, .receive = local_.receive + additional.receive};
-            MPI_Iallreduce(MPI_IN_PLACE, &global_, 2, kamping::mpi_datatype<std::size_t>(), MPI_SUM, comm_,
-                           &reduce_req_);
+            if (node_comm_ != MPI_COMM_NULL) {
+                stage_ = CountingStage::node_reduction;
+                MPI_Ireduce(node_rank_ == 0 ? MPI_IN_PLACE : &global_, node_rank_ == 0 ? &global_ : nullptr, 2,
+                            kamping::mpi_datatype<std::size_t>(), MPI_SUM, 0, node_comm_, &reduce_req_);
+            } else {
+                MPI_Iallreduce(MPI_IN_PLACE, &global_, 2, kamping::mpi_datatype<std::size_t>(), MPI_SUM, comm_,
+                               &reduce_req_);
+            }
+            num_termination_rounds_++;
+            single_round_ = false;
+        }
+    }
+
+    /// Start a counting round which decides on its own (see TerminationDetection::single_round). The caller must not
+    /// start any sends until the round has finished.
+    void start_single_round_counting() {
+        if (reduce_req_ == MPI_REQUEST_NULL) {
+            start_message_counting();
+            single_round_ = true;
+        }
+    }
+
+    /// Enter a non-blocking barrier instead of counting (see TerminationDetection::nbx). Once it completes, all ranks
+    /// have finished sending, so terminated() will hold.
+    void start_barrier() {
+        if (reduce_req_ == MPI_REQUEST_NULL) {
+            MPI_Ibarrier(comm_, &reduce_req_);
+            in_barrier_ = true;
             num_termination_rounds_++;
         }
     }
@@ -64,16 +216,35 @@ public:
     }
 
     [[nodiscard]] bool message_counting_finished() {
-        if (reduce_req_ == MPI_REQUEST_NULL) {
-            return true;
+        while (reduce_req_ != MPI_REQUEST_NULL) {
+            int reduce_finished = 0;
+            MPI_Test(&reduce_req_, &reduce_finished, MPI_STATUS_IGNORE);
+            if (!reduce_finished) {
+                return false;
+            }
+            start_next_counting_stage();
         }
-        int reduce_finished = 0;
-        MPI_Test(&reduce_req_, &reduce_finished, MPI_STATUS_IGNORE);
-        return static_cast<bool>(reduce_finished);
+        return true;
+    }
+
+    /// @return the request of the current stage of the running counting round, so that it can be waited on along with
+    /// other requests
+    [[nodiscard]] MPI_Request message_counting_request() const {
+        return reduce_req_;
+    }
+
+    /// The current stage of the counting round has been completed by waiting on a copy of message_counting_request(),
+    /// which freed the request. Start the next stage, if any.
+    void finish_message_counting() {
+        reduce_req_ = MPI_REQUEST_NULL;
+        start_next_counting_stage();
     }
 
     [[nodiscard]] bool terminated() {
-        bool terminated = global_ == previous_global_ && global_.send == global_.receive;
+        if (in_barrier_) {
+            return true;
+        }
+        bool terminated = (single_round_ || global_ == previous_global_) && global_.send == global_.receive;
         if (!terminated) {
             // store for double counting
             previous_global_ = global_;
@@ -83,13 +254,46 @@ public:
     }
 
 private:
+    enum class CountingStage : std::uint8_t { last, node_reduction, leader_reduction, node_broadcast };
+
+    // never equal to a real count, so that the first round cannot terminate under double counting
+    static constexpr MessageCounter NO_PREVIOUS_COUNT{.send = std::numeric_limits<std::size_t>::max(),
+                                                      .receive = std::numeric_limits<std::size_t>::max() - 1};
+
+    void start_next_counting_stage() {
+        switch (stage_) {
+            case CountingStage::node_reduction:
+                if (leader_comm_ != MPI_COMM_NULL) {
+                    stage_ = CountingStage::leader_reduction;
+                    MPI_Iallreduce(MPI_IN_PLACE, &global_, 2, kamping::mpi_datatype<std::size_t>(), MPI_SUM,
+                                   leader_comm_, &reduce_req_);
+                    return;
+                }
+                [[fallthrough]];
+            case CountingStage::leader_reduction:
+                stage_ = CountingStage::node_broadcast;
+                MPI_Ibcast(&global_, 2, kamping::mpi_datatype<std::size_t>(), 0, node_comm_, &reduce_req_);
+                return;
+            default:
+                stage_ = CountingStage::last;
+                return;
+        }
+    }
+
     MPI_Comm comm_;
+    MPI_Comm node_comm_ = MPI_COMM_NULL;    // the ranks sharing memory with us
+    MPI_Comm leader_comm_ = MPI_COMM_NULL;  // the first rank of each node, if we are one
+    int node_rank_ = 0;
     MPI_Request reduce_req_ = MPI_REQUEST_NULL;
+    MPI_Request epoch_req_ = MPI_REQUEST_NULL;  // the barrier separating the current epoch from the previous one
+    CountingStage stage_ = CountingStage::last;
     MessageCounter local_{.send = 0, .receive = 0};
     std::size_t num_termination_rounds_ = 0;
+    bool in_barrier_ = false;
+    bool single_round_ = false;
     MessageCounter global_{.send = 0, .receive = 0};
-    MessageCounter previous_global_{.send = std::numeric_limits<std::size_t>::max(),
-                                    .receive = std::numeric_limits<std::size_t>::max() - 1};
+    MessageCounter previous_global_ = NO_PREVIOUS_COUNT;
 };
 
-}  // namespace briefkasten::internal
+}  // namespace internal
+}  // namespace briefkasten
@@ -65,6 +65,8 @@ public:
         auto first_cfg = derive_indirection_config(first_hop_queue_.config(), first_hop_fan_out(indirection_));
         first_hop_queue_.max_num_aggregation_buffers(first_cfg.max_num_aggregation_buffers);
         first_hop_queue_.send_backlog_capacity(first_cfg.send_backlog_capacity);
+        first_hop_queue_.wait_strategy(first_cfg.wait_strategy);
+        first_hop_queue_.termination_detection(first_cfg.termination_detection);
     }
 
     auto& indirection_scheme() {
@@ -263,6 +265,13 @@ public:
         second_hop_queue_.synchronous_mode(use_it);
     }
 
+    /// Begin a new epoch after termination on both hops, keeping their receives, buffers and communicators. This is
+    /// collective.
+    void begin_epoch() {
+        first_hop_queue_.begin_epoch();
+        second_hop_queue_.begin_epoch();
+    }
+
     auto num_allocated_buffers() {
         return first_hop_queue_.num_allocated_buffers();
     }
@@ -308,6 +317,13 @@ private:
         if (config.max_num_aggregation_buffers == defaults.max_num_aggregation_buffers) {
             config.max_num_aggregation_buffers = (2 * fan_out) + config.num_request_slots;
         }
+        // each hop waits while the other one is polled by its progress hook, which MPI_Waitsome cannot see
+        if (config.wait_strategy == WaitStrategy::blocking) {
+            config.wait_strategy = WaitStrategy::backoff;
+        }
+        // the second hop forwards messages received on the first hop, which it neither may do after entering the
+        // barrier nor while the first hop is counting
+        config.termination_detection = TerminationDetection::double_counting;
         return config;
     }
 
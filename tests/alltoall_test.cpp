@@ -1,11 +1,15 @@
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
 #include <kamping/collectives/allreduce.hpp>
+#include <kamping/collectives/barrier.hpp>
 #include <kamping/communicator.hpp>
 
 #include <algorithm>
+#include <chrono>
+#include <functional>
 #include <limits>
 #include <random>
+#include <thread>
 
 #include "briefkasten/aggregators.hpp"
 #include "briefkasten/buffered_queue.hpp"
@@ -15,6 +19,86 @@
 
 constexpr std::size_t NUM_LOCAL_ELEMENTS = 1'000'000;
 
+namespace {
+
+/// @return the receivers of the alltoall, each element names the rank it is sent to. A share of \p hot_share of them
+/// goes to rank 0, the others are uniformly distributed.
+std::vector<int> generate_data(kamping::Communicator<> const& comm, double hot_share = 0.0) {
+    std::vector<int> data(NUM_LOCAL_ELEMENTS);
+    std::default_random_engine generator;
+    std::uniform_int_distribution<int> distribution(0, comm.size_signed() - 1);
+    std::bernoulli_distribution hot(hot_share);
+    std::ranges::generate(data, [&]() { return hot(generator) ? 0 : distribution(generator); });
+    return data;
+}
+
+/// Check that all ranks together received NUM_LOCAL_ELEMENTS elements per rank, and that this rank received only
+/// \p expected_element.
+void expect_received(kamping::Communicator<> const& comm, std::vector<int> const& received_data, int expected_element) {
+    using namespace ::testing;
+    namespace kmp = kamping::params;
+    EXPECT_THAT(received_data, Each(Eq(expected_element)));
+    auto total_receive_count = comm.allreduce_single(kmp::send_buf(received_data.size()), kmp::op(std::plus<>{}));
+    EXPECT_EQ(total_receive_count, NUM_LOCAL_ELEMENTS * comm.size());
+}
+
+/// Chunked interleaved alltoall using the message queue: each element of \p data is posted to the rank it names, and
+/// each rank has to receive exactly the elements naming it. \p after_post is called with the message handler after
+/// each post. The handler collecting the received elements may be wrapped by \p make_handler.
+template <typename Queue>
+void alltoall(Queue& queue, std::vector<int> const& data, auto&& after_post, auto&& make_handler) {
+    kamping::Communicator<> comm;
+    std::vector<int> received_data;
+    auto collect = [&](auto envelope) {
+        received_data.insert(received_data.end(), envelope.message.begin(), envelope.message.end());
+    };
+    auto&& on_message = make_handler(collect);
+    for (auto const& element : data) {
+        queue.post_message_blocking(element, element, on_message);
+        after_post(on_message);
+    }
+    while (!queue.terminate(on_message)) {
+    }
+    expect_received(comm, received_data, comm.rank_signed());
+}
+
+template <typename Queue>
+void alltoall(Queue& queue, std::vector<int> const& data, auto&& after_post) {
+    alltoall(queue, data, std::forward<decltype(after_post)>(after_post), std::identity{});
+}
+
+template <typename Queue>
+void alltoall(Queue& queue, std::vector<int> const& data) {
+    alltoall(queue, data, [](auto&& /* on_message */) {});
+}
+
+/// The alltoall on a queue configured by \p conf, which is returned for feature specific checks. A share of
+/// \p hot_share of the elements goes to rank 0.
+auto alltoall(briefkasten::Config const& conf, double hot_share = 0.0, bool synchronous_mode = false) {
+    kamping::Communicator<> comm;
+    auto data = generate_data(comm, hot_share);
+    auto queue = briefkasten::BufferedMessageQueueBuilder<int>(conf).build();
+    queue.synchronous_mode(synchronous_mode);
+    alltoall(queue, data);
+    return queue;
+}
+
+/// Forwards to a wrapped batch handler and counts the batches, like a handler adding instrumentation would.
+template <typename Handler>
+struct ForwardingBatchHandler {
+    void operator()(auto envelope) {
+        handler(std::move(envelope));
+    }
+    void on_batch(auto batch) {
+        (*num_batches)++;
+        handler.on_batch(std::move(batch));
+    }
+    Handler handler;
+    std::size_t* num_batches;
+};
+
+}  // namespace
+
 /// Chunked interleaved alltoall using the message queue
 TEST(BufferedQueueTest, alltoall) {
     using namespace ::testing;
@@ -47,6 +131,284 @@ TEST(BufferedQueueTest, alltoall) {
     EXPECT_EQ(total_receive_count, data.size() * comm.size());
 }
 
+TEST(BufferedQueueTest, alltoall_nbx) {
+    // termination is detected by a single barrier
+    briefkasten::Config conf;
+    conf.termination_detection = briefkasten::TerminationDetection::nbx;
+    auto queue = alltoall(conf, 0.0, /*synchronous_mode=*/true);
+    EXPECT_EQ(queue.num_termination_rounds(), 1);
+}
+
+TEST(BufferedQueueTest, alltoall_termination_fallback_with_flow_control) {
+    // the credits are returned by control messages, so all ranks fall back to double counting alike
+    kamping::Communicator<> comm;
+    for (auto termination_detection :
+         {briefkasten::TerminationDetection::single_round, briefkasten::TerminationDetection::nbx}) {
+        // the queues use the same tags, so the previous one must be gone on all ranks
+        comm.barrier();
+        briefkasten::Config conf;
+        conf.termination_detection = termination_detection;
+        conf.flow_control_credits = 8;
+        auto queue = alltoall(conf, 0.0, /*synchronous_mode=*/true);
+        EXPECT_GE(queue.num_termination_rounds(), 2);
+    }
+}
+
+TEST(BufferedQueueTest, alltoall_global_flush) {
+    // every overflow flushes all buffers; send slots may run out before the overflowing buffer is reached
+    briefkasten::Config conf;
+    conf.flush_strategy = briefkasten::FlushStrategy::global;
+    conf.global_threshold_bytes = 64ULL * 1024;
+    conf.send_completion_strategy = briefkasten::CompletionStrategy::round_robin;
+    std::ignore = alltoall(conf, 0.0, /*synchronous_mode=*/true);
+}
+
+TEST(BufferedQueueTest, alltoall_skewed) {
+    // half of the data goes to rank 0
+    kamping::Communicator<> comm;
+    briefkasten::Config conf;
+    conf.send_backlog_capacity = 4 * briefkasten::DEFAULT_NUM_REQUEST_SLOTS;
+    conf.send_backlog_capacity_per_destination = 2;
+    conf.max_num_aggregation_buffers = conf.num_request_slots + conf.send_backlog_capacity + comm.size();
+    std::ignore = alltoall(conf, 0.5, /*synchronous_mode=*/true);
+}
+
+TEST(BufferedQueueTest, alltoall_persistent_sends) {
+    // full buffers always have the same size, so recycled buffers hit the cache once paired with the same receiver
+    kamping::Communicator<> comm;
+    briefkasten::Config conf;
+    conf.persistent_send_cache_capacity = conf.max_num_aggregation_buffers * comm.size();
+    auto queue = alltoall(conf, 0.0, /*synchronous_mode=*/true);
+    EXPECT_GT(queue.underlying().num_persistent_sends(), 0);
+}
+
+TEST(BufferedQueueTest, alltoall_elastic_send_slots) {
+    briefkasten::Config conf;
+    conf.num_request_slots = 1;
+    conf.min_num_request_slots = 1;
+    conf.max_num_request_slots = 4 * briefkasten::DEFAULT_NUM_REQUEST_SLOTS;
+    conf.max_num_aggregation_buffers = 2 * conf.max_num_request_slots;
+    auto queue = alltoall(conf, 0.0, /*synchronous_mode=*/true);
+    EXPECT_GE(queue.num_send_slots(), conf.min_num_request_slots);
+    EXPECT_LE(queue.num_send_slots(), conf.max_num_request_slots);
+}
+
+TEST(BufferedQueueTest, alltoall_elastic_receive_slots) {
+    // small buffers make for many messages, half of them to rank 0
+    briefkasten::Config conf;
+    conf.local_threshold_bytes = 16 * sizeof(int);
+    conf.min_num_receive_slots = 1;
+    conf.max_num_receive_slots = 4 * briefkasten::DEFAULT_NUM_REQUEST_SLOTS;
+    auto queue = alltoall(conf, 0.5);
+    EXPECT_GE(queue.num_receive_slots(), conf.min_num_receive_slots);
+    EXPECT_LE(queue.num_receive_slots(), conf.max_num_receive_slots);
+}
+
+TEST(BufferedQueueTest, alltoall_early_receive_restart) {
+    // small buffers make for many messages, the receive slots grow and shrink while being restarted early
+    briefkasten::Config conf;
+    conf.local_threshold_bytes = 16 * sizeof(int);
+    conf.min_num_receive_slots = 1;
+    conf.max_num_receive_slots = 4 * briefkasten::DEFAULT_NUM_REQUEST_SLOTS;
+    conf.early_receive_restart = true;
+    auto queue = alltoall(conf, 0.5);
+    // every rank is sent some of the elements, all in small messages
+    EXPECT_GT(queue.underlying().num_early_receive_restarts(), 0);
+}
+
+TEST(BufferedQueueTest, alltoall_flow_control) {
+    // small buffers, so that many messages compete for the few credits
+    briefkasten::Config conf;
+    conf.local_threshold_bytes = 64 * sizeof(int);
+    conf.flow_control_credits = 2;
+    std::ignore = alltoall(conf, 0.5);
+}
+
+TEST(BufferedQueueTest, alltoall_coalescing) {
+    // global flushes with a single send slot fill the backlog, which is coalesced when draining
+    kamping::Communicator<> comm;
+    briefkasten::Config conf;
+    conf.num_request_slots = 1;
+    conf.flush_strategy = briefkasten::FlushStrategy::global;
+    conf.global_threshold_bytes = 256 * sizeof(int);
+    conf.local_threshold_bytes = 1024 * sizeof(int);
+    conf.send_backlog_capacity = 4 * comm.size();
+    conf.max_num_aggregation_buffers = conf.num_request_slots + conf.send_backlog_capacity + comm.size();
+    conf.coalesce_send_backlog = true;
+    std::ignore = alltoall(conf);
+}
+
+TEST(BufferedQueueTest, alltoall_probe_receiver) {
+    // small messages are received by matched probes instead of posted receives
+    kamping::Communicator<> comm;
+    auto queue = briefkasten::BufferedMessageQueueBuilder<int>().with_receiver<briefkasten::ProbeReceiver>().build();
+    alltoall(queue, generate_data(comm));
+}
+
+TEST(BufferedQueueTest, alltoall_batch_handler) {
+    // the sentinels separate the messages in a buffer, all messages of a received buffer are handled at once
+    kamping::Communicator<> comm;
+    auto queue = briefkasten::BufferedMessageQueueBuilder<int>()
+                     .with_merger(briefkasten::aggregation::SentinelMerger<int>(-1))
+                     .with_splitter(briefkasten::aggregation::SentinelSplitter<int>(-1))
+                     .build();
+    std::size_t num_batches = 0;
+    std::size_t num_messages = 0;
+    alltoall(
+        queue, generate_data(comm), [](auto&& /* on_message */) {},
+        [&](auto& collect) {
+            return briefkasten::BatchHandler{[&](auto batch) {
+                num_batches++;
+                for (auto&& envelope : batch) {
+                    num_messages++;
+                    collect(std::move(envelope));
+                }
+            }};
+        });
+    // the buffers hold many messages each
+    EXPECT_LT(num_batches, num_messages);
+}
+
+TEST(BufferedQueueTest, alltoall_forwarding_batch_handler) {
+    // a handler which is no BatchHandler itself, but forwards batches to one, gets the messages as batches, too
+    kamping::Communicator<> comm;
+    auto queue = briefkasten::BufferedMessageQueueBuilder<int>()
+                     .with_merger(briefkasten::aggregation::SentinelMerger<int>(-1))
+                     .with_splitter(briefkasten::aggregation::SentinelSplitter<int>(-1))
+                     .build();
+    std::size_t num_batches = 0;
+    std::size_t num_messages = 0;
+    alltoall(
+        queue, generate_data(comm), [](auto&& /* on_message */) {},
+        [&](auto& collect) {
+            briefkasten::BatchHandler batch_handler{[&](auto batch) {
+                for (auto&& envelope : batch) {
+                    num_messages++;
+                    collect(std::move(envelope));
+                }
+            }};
+            return ForwardingBatchHandler{std::move(batch_handler), &num_batches};
+        });
+    EXPECT_LT(num_batches, num_messages);
+}
+
+TEST(BufferedQueueTest, alltoall_poll_budget) {
+    constexpr std::size_t POLL_INTERVAL = 64;
+    kamping::Communicator<> comm;
+    // small buffers make for many messages per poll
+    briefkasten::Config conf;
+    conf.local_threshold_bytes = 16 * sizeof(int);
+    conf.max_adaptive_poll_skip_threshold = POLL_INTERVAL;
+    auto queue = briefkasten::BufferedMessageQueueBuilder<int>(conf).build();
+
+    // the posts are interleaved with polls bounded by the number of messages or by time
+    constexpr std::chrono::microseconds MAX_POLL_DURATION{10};
+    std::size_t num_handled = 0;
+    std::size_t num_posted = 0;
+    alltoall(
+        queue, generate_data(comm),
+        [&](auto& on_message) {
+            queue.poll_throttled(on_message);
+            EXPECT_LE(queue.underlying().adaptive_poll_skip_threshold(), POLL_INTERVAL);
+            if (++num_posted % POLL_INTERVAL == 0) {
+                num_handled = 0;
+                queue.poll_for({.max_messages = 1}, on_message);
+                EXPECT_LE(num_handled, 1);
+                // each message outlasts the budget, so the deadline has passed after the first one
+                num_handled = 0;
+                queue.poll_for({.max_duration = MAX_POLL_DURATION}, [&](auto envelope) {
+                    std::this_thread::sleep_for(MAX_POLL_DURATION);
+                    on_message(std::move(envelope));
+                });
+                EXPECT_LE(num_handled, 1);
+            }
+        },
+        [&](auto& collect) {
+            return [&](auto envelope) {
+                num_handled++;
+                collect(std::move(envelope));
+            };
+        });
+
+    // all messages have been received, so the polls of the idle queue miss and the skip threshold grows to its maximum
+    for (std::size_t i = 0; i < 2 * briefkasten::POLL_THROTTLING_WINDOW * POLL_INTERVAL; i++) {
+        queue.poll_throttled([](auto /* envelope */) {});
+    }
+    EXPECT_EQ(queue.underlying().adaptive_poll_skip_threshold(), POLL_INTERVAL);
+}
+
+TEST(BufferedQueueTest, alltoall_hierarchical_termination) {
+    // the message counts are reduced within each node first
+    briefkasten::Config conf;
+    conf.hierarchical_termination = true;
+    std::ignore = alltoall(conf);
+}
+
+TEST(BufferedQueueTest, alltoall_wait_strategies) {
+    using enum briefkasten::WaitStrategy;
+    kamping::Communicator<> comm;
+    for (auto wait_strategy : {spin, spin_then_yield, backoff, blocking}) {
+        // the queues use the same tags, so the previous one must be gone on all ranks
+        comm.barrier();
+        briefkasten::Config conf;
+        conf.wait_strategy = wait_strategy;
+        auto queue = briefkasten::BufferedMessageQueueBuilder<int>(conf).build();
+        auto data = generate_data(comm);
+        // the last rank pauses after posting, so the others wait for it while terminating
+        std::size_t num_posted = 0;
+        alltoall(queue, data, [&](auto&& /* on_message */) {
+            if (++num_posted == data.size() && comm.rank_signed() == comm.size_signed() - 1) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+        });
+        if (comm.rank_signed() != comm.size_signed() - 1) {
+            // we have waited for the last rank, blocking in MPI if the wait strategy allows it
+            EXPECT_GT(queue.wait_time().count(), 0);
+            if (wait_strategy == blocking) {
+                EXPECT_GT(queue.num_blocking_waits(), 0);
+            } else {
+                EXPECT_EQ(queue.num_blocking_waits(), 0);
+            }
+        }
+    }
+}
+
+TEST(BufferedQueueTest, alltoall_epochs) {
+    kamping::Communicator<> comm;
+    auto data = generate_data(comm);
+
+    // init queue, which is reused for all epochs
+    comm.barrier();
+    // the credits are returned by control messages, which are held back until all ranks have begun the epoch as well
+    briefkasten::Config conf;
+    conf.flow_control_credits = 8;
+    auto queue = briefkasten::BufferedMessageQueueBuilder<int>(conf).build();
+    constexpr int NUM_EPOCHS = 3;
+    // checked after the last epoch, as checking is collective and would let the ranks begin each epoch together
+    std::vector<std::vector<int>> received_data(NUM_EPOCHS);
+    for (int epoch = 0; epoch < NUM_EPOCHS; epoch++) {
+        // each message carries its epoch
+        auto on_message = [&](auto envelope) {
+            received_data[epoch].insert(received_data[epoch].end(), envelope.message.begin(), envelope.message.end());
+        };
+        for (auto& element : data) {
+            queue.post_message_blocking(epoch, element, on_message);
+        }
+        while (!queue.terminate(on_message)) {
+        }
+
+        // the first rank rushes ahead and posts the messages of the next epoch, while the others are still leaving
+        // the previous one
+        if (comm.rank_signed() != 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        queue.begin_epoch();
+    }
+    for (int epoch = 0; epoch < NUM_EPOCHS; epoch++) {
+        expect_received(comm, received_data[epoch], epoch);
+    }
+}
+
 TEST(BufferedQueueTest, alltoall_indirect) {
     using namespace ::testing;
     namespace kmp = kamping::params;
@@ -0,0 +1,605 @@
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <kamping/communicator.hpp>
+
+#include <algorithm>
+#include <concepts>
+#include <cstddef>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <unordered_set>
+#include <vector>
+
+#include "briefkasten/detail/queue.hpp"
+
+constexpr std::size_t NUM_REQUEST_SLOTS = 8;
+constexpr std::size_t SLICE_SIZE = 1000;
+
+/// Every rank floods its right neighbor through a single send slot, and then sends one message to itself. That message
+/// must not wait until the flood has drained.
+TEST(MessageQueueTest, send_backlog_fairness) {
+    using namespace ::testing;
+    constexpr std::size_t NUM_FLOODED = 64;
+    kamping::Communicator<> comm;
+    // all queues use the same tags, so the queue of the previous test must be gone on all ranks
+    comm.barrier();
+
+    briefkasten::MessageQueue<int> queue(comm.mpi_communicator(), 1, SLICE_SIZE, NUM_FLOODED);
+    std::size_t num_received = 0;
+    auto on_message = [&](auto envelope) { num_received += envelope.message.size() == SLICE_SIZE ? 1 : 0; };
+    briefkasten::PEID flooded = (comm.rank_signed() + 1) % comm.size_signed();
+    for (std::size_t i = 0; i < NUM_FLOODED; i++) {
+        ASSERT_TRUE(queue.post_message(std::vector<int>(SLICE_SIZE, comm.rank_signed()), flooded).has_value());
+    }
+    auto receipt = queue.post_message(std::vector<int>{comm.rank_signed()}, comm.rank_signed());
+    ASSERT_TRUE(receipt.has_value());
+    queue.wait_receipt(*receipt, on_message);
+    if (flooded != comm.rank_signed()) {
+        // the freed slots alternate between the destinations, so at most two messages of the flood went first
+        EXPECT_GE(queue.outstanding_sends(flooded), NUM_FLOODED - 2);
+    }
+    while (!queue.terminate(on_message)) {
+    }
+    EXPECT_EQ(num_received, NUM_FLOODED);
+}
+
+/// Every rank sends a slice of a vector it owns to every rank, without copying the slices.
+TEST(MessageQueueTest, post_borrowed_message) {
+    using namespace ::testing;
+    kamping::Communicator<> comm;
+    // all queues use the same tags, so the queue of the previous test must be gone on all ranks
+    comm.barrier();
+    std::vector<int> data(SLICE_SIZE * comm.size());
+    for (std::size_t i = 0; i < data.size(); i++) {
+        data[i] = static_cast<int>(i / SLICE_SIZE);
+    }
+
+    briefkasten::MessageQueue<int> queue(comm.mpi_communicator(), NUM_REQUEST_SLOTS, SLICE_SIZE);
+    std::vector<int> received_data;
+    auto on_message = [&](auto envelope) {
+        received_data.insert(received_data.end(), envelope.message.begin(), envelope.message.end());
+    };
+    std::unordered_set<std::size_t> pending_receipts;
+    auto on_finished_sending = [&](std::size_t receipt) { pending_receipts.erase(receipt); };
+
+    for (int receiver = 0; receiver < comm.size_signed(); receiver++) {
+        auto slice = std::span<const int>(data).subspan(receiver * SLICE_SIZE, SLICE_SIZE);
+        std::optional<std::size_t> receipt;
+        while (!(receipt = queue.post_borrowed_message(slice, receiver)).has_value()) {
+            queue.poll(on_message, on_finished_sending);
+        }
+        pending_receipts.insert(*receipt);
+    }
+    while (!pending_receipts.empty()) {
+        queue.poll(on_message, on_finished_sending);
+    }
+    // all sends have finished, so the memory could be reused now
+    data.clear();
+    while (!queue.terminate(on_message)) {
+    }
+
+    EXPECT_EQ(received_data.size(), SLICE_SIZE * comm.size());
+    EXPECT_THAT(received_data, Each(Eq(comm.rank())));
+}
+
+/// Every rank sends a large message to every rank, releasing its partitions one after another while filling it.
+TEST(MessageQueueTest, post_partitioned_message) {
+    using namespace ::testing;
+    constexpr std::size_t NUM_PARTITIONS = 4;
+    kamping::Communicator<> comm;
+    // all queues use the same tags, so the queue of the previous test must be gone on all ranks
+    comm.barrier();
+    std::vector<std::vector<int>> messages(comm.size(), std::vector<int>(NUM_PARTITIONS * SLICE_SIZE));
+
+    briefkasten::MessageQueue<int> queue(comm.mpi_communicator(), NUM_REQUEST_SLOTS, SLICE_SIZE);
+    queue.allow_large_messages();
+    queue.enable_partitioned_messages();
+    std::vector<std::vector<int>> received_messages;
+    auto on_message = [&](auto envelope) {
+        received_messages.emplace_back(envelope.message.begin(), envelope.message.end());
+    };
+    std::unordered_set<std::size_t> pending_receipts;
+    auto on_finished_sending = [&](std::size_t receipt) { pending_receipts.erase(receipt); };
+
+    for (int receiver = 0; receiver < comm.size_signed(); receiver++) {
+        auto& message = messages[receiver];
+        std::optional<std::size_t> receipt;
+        while (!(receipt = queue.post_partitioned_message(message, receiver, NUM_PARTITIONS)).has_value()) {
+            queue.poll(on_message, on_finished_sending);
+        }
+        pending_receipts.insert(*receipt);
+        for (std::size_t partition = 0; partition < NUM_PARTITIONS; partition++) {
+            auto slice = std::span(message).subspan(partition * SLICE_SIZE, SLICE_SIZE);
+            std::ranges::fill(slice, comm.rank_signed() + static_cast<int>(partition));
+            queue.mark_partition_ready(*receipt, partition);
+            queue.poll(on_message, on_finished_sending);
+        }
+    }
+    while (!pending_receipts.empty()) {
+        queue.poll(on_message, on_finished_sending);
+    }
+    while (!queue.terminate(on_message)) {
+    }
+
+    ASSERT_EQ(received_messages.size(), comm.size());
+    for (auto const& message : received_messages) {
+        ASSERT_EQ(message.size(), NUM_PARTITIONS * SLICE_SIZE);
+        int sender = message.front();
+        for (std::size_t i = 0; i < message.size(); i++) {
+            EXPECT_EQ(message[i], sender + static_cast<int>(i / SLICE_SIZE));
+        }
+    }
+}
+
+#if MPI_VERSION >= 4
+/// With partitioned communication, a partitioned message takes a flow control credit until the receiver has handled it.
+TEST(MessageQueueTest, partitioned_message_flow_control) {
+    constexpr std::size_t NUM_PARTITIONS = 2;
+    kamping::Communicator<> comm;
+    // all queues use the same tags, so the queue of the previous test must be gone on all ranks
+    comm.barrier();
+    std::vector<int> message(NUM_PARTITIONS * SLICE_SIZE, comm.rank_signed());
+
+    briefkasten::MessageQueue<int> queue(comm.mpi_communicator(), NUM_REQUEST_SLOTS, SLICE_SIZE);
+    queue.set_flow_control_credits(1);
+    queue.enable_partitioned_messages();
+    std::size_t num_received = 0;
+    auto on_message = [&](auto envelope) {
+        EXPECT_EQ(envelope.message.size(), message.size());
+        EXPECT_TRUE(std::ranges::all_of(envelope.message, [&](int value) { return value == envelope.sender; }));
+        num_received++;
+    };
+    briefkasten::PEID receiver = (comm.rank_signed() + 1) % comm.size_signed();
+    auto receipt = queue.post_partitioned_message(message, receiver, NUM_PARTITIONS);
+    ASSERT_TRUE(receipt.has_value());
+    // the only credit is returned once the receiver has handled the message, which needs us to poll
+    EXPECT_FALSE(queue.post_partitioned_message(message, receiver, NUM_PARTITIONS).has_value());
+    for (std::size_t partition = 0; partition < NUM_PARTITIONS; partition++) {
+        queue.mark_partition_ready(*receipt, partition);
+    }
+    queue.wait_receipt(*receipt, on_message);
+    while (!queue.terminate(on_message)) {
+    }
+    EXPECT_EQ(num_received, 1);
+}
+#endif
+
+/// Lowering the bounds of the receive slots below their number retires the surplus slots on the next poll, even if the
+/// number of slots is fixed. Raising them posts the missing slots right away.
+TEST(MessageQueueTest, receive_slot_bounds) {
+    kamping::Communicator<> comm;
+    // all queues use the same tags, so the queue of the previous test must be gone on all ranks
+    comm.barrier();
+
+    briefkasten::MessageQueue<int> queue(comm.mpi_communicator(), NUM_REQUEST_SLOTS, SLICE_SIZE);
+    std::size_t num_received = 0;
+    auto on_message = [&](auto /* envelope */) { num_received++; };
+    EXPECT_EQ(queue.num_receive_slots(), NUM_REQUEST_SLOTS);
+    queue.set_receive_slot_bounds(2, 2);
+    queue.poll(on_message);
+    EXPECT_EQ(queue.num_receive_slots(), 2);
+    queue.set_receive_slot_bounds(4, 4);
+    EXPECT_EQ(queue.num_receive_slots(), 4);
+
+    for (int receiver = 0; receiver < comm.size_signed(); receiver++) {
+        while (!queue.post_message(std::vector<int>(SLICE_SIZE, comm.rank_signed()), receiver).has_value()) {
+            queue.poll(on_message);
+        }
+    }
+    while (!queue.terminate(on_message)) {
+    }
+    EXPECT_EQ(num_received, comm.size());
+    EXPECT_EQ(queue.num_receive_slots(), 4);
+}
+
+/// Every rank sends a slice of a vector to every rank and reuses it as soon as the send is reported as finished.
+TEST(MessageQueueTest, wait_for_receipts) {
+    using namespace ::testing;
+    kamping::Communicator<> comm;
+    // all queues use the same tags, so the queue of the previous test must be gone on all ranks
+    comm.barrier();
+    std::vector<int> data(SLICE_SIZE);
+
+    briefkasten::MessageQueue<int> queue(comm.mpi_communicator(), NUM_REQUEST_SLOTS, SLICE_SIZE);
+    std::vector<int> received_data;
+    auto on_message = [&](auto envelope) {
+        received_data.insert(received_data.end(), envelope.message.begin(), envelope.message.end());
+    };
+
+    for (int receiver = 0; receiver < comm.size_signed(); receiver++) {
+        std::ranges::fill(data, comm.rank_signed());
+        std::optional<std::size_t> receipt;
+        while (!(receipt = queue.post_borrowed_message(data, receiver)).has_value()) {
+            queue.poll(on_message);
+        }
+        queue.wait_receipt(*receipt, on_message);
+        EXPECT_TRUE(queue.test_receipt(*receipt));
+        // the buffer may be reused now
+        std::ranges::fill(data, -1);
+    }
+    // more receipts than fit into the initial receipt window
+    std::vector<std::size_t> receipts;
+    for (std::size_t i = 0; i < 2 * briefkasten::MIN_RECEIPT_WINDOW_SIZE; i++) {
+        for (int receiver = 0; receiver < comm.size_signed(); receiver++) {
+            std::optional<std::size_t> receipt;
+            while (!(receipt = queue.post_message(std::vector<int>(1, comm.rank_signed()), receiver)).has_value()) {
+                queue.poll(on_message);
+            }
+            receipts.push_back(*receipt);
+        }
+    }
+    queue.wait_all_receipts(on_message);
+    EXPECT_TRUE(std::ranges::all_of(receipts, [&](std::size_t receipt) { return queue.test_receipt(receipt); }));
+    while (!queue.terminate(on_message)) {
+    }
+
+    EXPECT_EQ(received_data.size(), (SLICE_SIZE + 2 * briefkasten::MIN_RECEIPT_WINDOW_SIZE) * comm.size());
+    EXPECT_THAT(received_data, Each(Ge(0)));
+}
+
+/// Every rank sends a message to every rank. The receivers keep the receive buffers instead of copying the messages.
+TEST(MessageQueueTest, receive_buffer_handover) {
+    using namespace ::testing;
+    kamping::Communicator<> comm;
+    // all queues use the same tags, so the queue of the previous test must be gone on all ranks
+    comm.barrier();
+
+    briefkasten::MessageQueue<int> queue(comm.mpi_communicator(), NUM_REQUEST_SLOTS, SLICE_SIZE);
+    queue.set_receive_buffer_handover();
+    std::vector<std::vector<int>> received_messages;
+    std::size_t num_handed_over = 0;
+    auto on_message = [&](auto envelope) {
+        if constexpr (std::same_as<decltype(envelope.message), briefkasten::HandedOverBuffer<std::vector<int>>>) {
+            received_messages.emplace_back(std::move(envelope.message).release());
+            num_handed_over++;
+        } else {
+            received_messages.emplace_back(envelope.message.begin(), envelope.message.end());
+        }
+    };
+
+    for (int receiver = 0; receiver < comm.size_signed(); receiver++) {
+        while (!queue.post_message(std::vector<int>(SLICE_SIZE / 2, comm.rank_signed()), receiver).has_value()) {
+            queue.poll(on_message);
+        }
+    }
+    while (!queue.terminate(on_message)) {
+    }
+
+    ASSERT_EQ(received_messages.size(), comm.size());
+    EXPECT_EQ(num_handed_over, comm.size());
+    for (auto const& message : received_messages) {
+        EXPECT_THAT(message, SizeIs(SLICE_SIZE / 2));
+        EXPECT_THAT(message, Each(Eq(message.front())));
+    }
+}
+
+/// Like receive_buffer_handover, but the handler keeps only some of the buffers, and some messages are empty. The slots
+/// are restarted with the buffers left in the envelopes.
+TEST(MessageQueueTest, receive_buffer_handover_recycling) {
+    constexpr std::size_t NUM_ROUNDS = 16;
+    kamping::Communicator<> comm;
+    // all queues use the same tags, so the queue of the previous test must be gone on all ranks
+    comm.barrier();
+
+    briefkasten::MessageQueue<int> queue(comm.mpi_communicator(), NUM_REQUEST_SLOTS, SLICE_SIZE);
+    queue.set_receive_buffer_handover();
+    std::vector<std::vector<int>> kept_messages;
+    std::size_t num_received = 0;
+    std::size_t num_empty = 0;
+    auto on_message = [&](auto envelope) {
+        num_received++;
+        num_empty += envelope.message.empty() ? 1 : 0;
+        if constexpr (std::same_as<decltype(envelope.message), briefkasten::HandedOverBuffer<std::vector<int>>>) {
+            if (!envelope.message.empty() && envelope.message.front() % 2 == 0) {
+                kept_messages.emplace_back(std::move(envelope.message).release());
+            }
+        }
+    };
+
+    for (std::size_t round = 0; round < NUM_ROUNDS; round++) {
+        // every fourth round is empty, the others alternate between kept and left buffers
+        std::size_t message_size = round % 4 == 3 ? 0 : SLICE_SIZE / 2;
+        for (int receiver = 0; receiver < comm.size_signed(); receiver++) {
+            while (!queue.post_message(std::vector<int>(message_size, static_cast<int>(round)), receiver).has_value()) {
+                queue.poll(on_message);
+            }
+        }
+        queue.poll(on_message);
+    }
+    while (!queue.terminate(on_message)) {
+    }
+
+    EXPECT_EQ(num_received, NUM_ROUNDS * comm.size());
+    EXPECT_EQ(num_empty, NUM_ROUNDS / 4 * comm.size());
+    EXPECT_EQ(kept_messages.size(), NUM_ROUNDS / 2 * comm.size());
+    for (auto const& message : kept_messages) {
+        EXPECT_EQ(message.size(), SLICE_SIZE / 2);
+    }
+}
+
+/// Like receive_buffer_handover_recycling, but the handler takes every buffer and returns it once it is done. The
+/// returned buffers get their persistent receives back, so no new ones are created per message.
+TEST(MessageQueueTest, receive_buffer_handover_returned_buffers) {
+    constexpr std::size_t NUM_ROUNDS = 16;
+    kamping::Communicator<> comm;
+    // all queues use the same tags, so the queue of the previous test must be gone on all ranks
+    comm.barrier();
+
+    briefkasten::MessageQueue<int> queue(comm.mpi_communicator(), NUM_REQUEST_SLOTS, SLICE_SIZE);
+    queue.set_receive_buffer_handover();
+    std::size_t num_received = 0;
+    auto on_message = [&](auto envelope) {
+        num_received++;
+        if constexpr (std::same_as<decltype(envelope.message), briefkasten::HandedOverBuffer<std::vector<int>>>) {
+            EXPECT_EQ(envelope.message.size(), SLICE_SIZE / 2);
+            // the buffer keeps its full size
+            EXPECT_EQ(envelope.message.buffer().size(), SLICE_SIZE);
+            queue.recycle_receive_buffer(std::move(envelope.message));
+        }
+    };
+
+    for (std::size_t round = 0; round < NUM_ROUNDS; round++) {
+        for (int receiver = 0; receiver < comm.size_signed(); receiver++) {
+            while (!queue.post_message(std::vector<int>(SLICE_SIZE / 2, static_cast<int>(round)), receiver)
+                        .has_value()) {
+                queue.poll(on_message);
+            }
+        }
+        queue.poll(on_message);
+    }
+    while (!queue.terminate(on_message)) {
+    }
+
+    EXPECT_EQ(num_received, NUM_ROUNDS * comm.size());
+    // the receives of the slots, and at most one per recycled buffer
+    EXPECT_LE(queue.num_receive_inits(), 2 * NUM_REQUEST_SLOTS);
+}
+
+/// Every rank sends large messages of varying size to every rank, which are received into recycled buffers.
+TEST(MessageQueueTest, large_message_buffer_pool) {
+    using namespace ::testing;
+    constexpr std::size_t NUM_ROUNDS = 8;
+    kamping::Communicator<> comm;
+    // all queues use the same tags, so the queue of the previous test must be gone on all ranks
+    comm.barrier();
+
+    briefkasten::MessageQueue<int> queue(comm.mpi_communicator(), NUM_REQUEST_SLOTS, SLICE_SIZE);
+    queue.allow_large_messages();
+    constexpr std::size_t BUFFER_POOL_CAPACITY = NUM_REQUEST_SLOTS * 4 * SLICE_SIZE * sizeof(int);
+    queue.set_large_message_buffer_pool_capacity(BUFFER_POOL_CAPACITY);
+    std::vector<std::size_t> received_sizes;
+    // the handler only reads the message, so the buffer goes back to the pool
+    auto on_message = [&](auto&& envelope) {
+        EXPECT_TRUE(std::ranges::all_of(envelope.message, [&](int value) { return value == envelope.sender; }));
+        received_sizes.push_back(envelope.message.size());
+    };
+
+    for (std::size_t round = 0; round < NUM_ROUNDS; round++) {
+        // sizes decrease within and across power-of-two size classes
+        std::size_t message_size = SLICE_SIZE + ((NUM_ROUNDS - 1 - round) * SLICE_SIZE / 3);
+        for (int receiver = 0; receiver < comm.size_signed(); receiver++) {
+            while (!queue.post_message(std::vector<int>(message_size, comm.rank_signed()), receiver).has_value()) {
+                queue.poll(on_message);
+            }
+        }
+    }
+    while (!queue.terminate(on_message)) {
+    }
+
+    EXPECT_EQ(received_sizes.size(), NUM_ROUNDS * comm.size());
+    // the last round fits into the receive buffers. Large messages are handled one at a time, so all but the first
+    // one reuse a recycled buffer of their size class or a larger one. Only with several senders, a message of 4096
+    // elements may arrive after the first one of 2048 elements and need a new buffer, too.
+    std::size_t num_large_messages = (NUM_ROUNDS - 1) * comm.size();
+    EXPECT_GE(queue.num_reused_large_message_buffers(), num_large_messages - std::min<std::size_t>(comm.size(), 2));
+    EXPECT_GT(queue.large_message_buffer_pool_bytes(), 0);
+    EXPECT_LE(queue.large_message_buffer_pool_bytes(), BUFFER_POOL_CAPACITY);
+}
+
+/// Every rank sends large messages to every rank, which the receivers pull from the sender's memory.
+TEST(MessageQueueTest, rma_rendezvous) {
+    using namespace ::testing;
+    kamping::Communicator<> comm;
+    // all queues use the same tags, so the queue of the previous test must be gone on all ranks
+    comm.barrier();
+    std::vector<int> data(4 * SLICE_SIZE, comm.rank_signed());
+
+    briefkasten::MessageQueue<int> queue(comm.mpi_communicator(), NUM_REQUEST_SLOTS, SLICE_SIZE);
+    queue.allow_large_messages();
+    queue.enable_rma_rendezvous();
+    std::vector<std::vector<int>> received_messages;
+    auto on_message = [&](auto envelope) {
+        received_messages.emplace_back(envelope.message.begin(), envelope.message.end());
+    };
+    std::unordered_set<std::size_t> pending_receipts;
+    auto on_finished_sending = [&](std::size_t receipt) { pending_receipts.erase(receipt); };
+
+    for (int receiver = 0; receiver < comm.size_signed(); receiver++) {
+        auto owned_receipt = queue.post_message(std::vector<int>(2 * SLICE_SIZE, comm.rank_signed()), receiver);
+        auto borrowed_receipt = queue.post_borrowed_message(data, receiver);
+        ASSERT_TRUE(owned_receipt.has_value() && borrowed_receipt.has_value());
+        pending_receipts.insert({*owned_receipt, *borrowed_receipt});
+        // held until the receiver has pulled them
+        EXPECT_FALSE(queue.test_receipt(*owned_receipt) || queue.test_receipt(*borrowed_receipt));
+    }
+    // each owned message has a region of its own, the borrowed ones share one
+    EXPECT_LE(queue.num_exposed_regions(), comm.size() + 1);
+    while (!pending_receipts.empty()) {
+        queue.poll(on_message, on_finished_sending);
+    }
+    // all receivers have pulled the data
+    EXPECT_EQ(queue.num_exposed_regions(), 0);
+    data.clear();
+    while (!queue.terminate(on_message)) {
+    }
+
+    ASSERT_EQ(received_messages.size(), 2 * comm.size());
+    std::size_t num_borrowed = 0;
+    for (auto const& message : received_messages) {
+        EXPECT_THAT(message, AnyOf(SizeIs(2 * SLICE_SIZE), SizeIs(4 * SLICE_SIZE)));
+        EXPECT_THAT(message, Each(Eq(message.front())));
+        num_borrowed += message.size() == 4 * SLICE_SIZE ? 1 : 0;
+    }
+    EXPECT_EQ(num_borrowed, comm.size());
+}
+
+/// Every rank grows its receive buffers at a different time and then sends messages which only fit into the grown
+/// buffers to every rank, while some of them are still receiving into buffers of the old size.
+TEST(MessageQueueTest, rolling_receive_buffer_resize) {
+    using namespace ::testing;
+    constexpr std::size_t NUM_ROUNDS = 8;
+    kamping::Communicator<> comm;
+    // all queues use the same tags, so the queue of the previous test must be gone on all ranks
+    comm.barrier();
+
+    briefkasten::MessageQueue<int> queue(comm.mpi_communicator(), NUM_REQUEST_SLOTS, SLICE_SIZE);
+    // covers the standby receives, which have to grow as well
+    queue.set_early_receive_restart(comm.rank() % 2 == 1);
+    std::vector<std::vector<int>> received_messages;
+    auto on_message = [&](auto envelope) {
+        received_messages.emplace_back(envelope.message.begin(), envelope.message.end());
+    };
+
+    for (int receiver = 0; receiver < comm.size_signed(); receiver++) {
+        while (!queue.post_message(std::vector<int>(SLICE_SIZE, comm.rank_signed()), receiver).has_value()) {
+            queue.poll(on_message);
+        }
+    }
+    for (std::size_t i = 0; i < 10 * comm.rank(); i++) {
+        queue.poll(on_message);
+    }
+    queue.resize_receive_buffers(4 * SLICE_SIZE, on_message);
+    for (std::size_t round = 0; round < NUM_ROUNDS; round++) {
+        for (int receiver = 0; receiver < comm.size_signed(); receiver++) {
+            while (!queue.post_message(std::vector<int>(2 * SLICE_SIZE, comm.rank_signed()), receiver).has_value()) {
+                queue.poll(on_message);
+            }
+        }
+        queue.poll(on_message);
+    }
+    while (!queue.terminate(on_message)) {
+    }
+
+    ASSERT_EQ(received_messages.size(), (NUM_ROUNDS + 1) * comm.size());
+    std::size_t num_grown = 0;
+    for (auto const& message : received_messages) {
+        EXPECT_THAT(message, AnyOf(SizeIs(SLICE_SIZE), SizeIs(2 * SLICE_SIZE)));
+        EXPECT_THAT(message, Each(Eq(message.front())));
+        num_grown += message.size() == 2 * SLICE_SIZE ? 1 : 0;
+    }
+    EXPECT_EQ(num_grown, NUM_ROUNDS * comm.size());
+}
+
+/// Only rank 0 grows its receive buffers and sends messages which only fit into the grown buffers to every rank. The
+/// other ranks never grow theirs, but receive the messages nonetheless.
+TEST(MessageQueueTest, one_sided_receive_buffer_resize) {
+    using namespace ::testing;
+    kamping::Communicator<> comm;
+    // all queues use the same tags, so the queue of the previous test must be gone on all ranks
+    comm.barrier();
+
+    briefkasten::MessageQueue<int> queue(comm.mpi_communicator(), NUM_REQUEST_SLOTS, SLICE_SIZE);
+    std::vector<std::vector<int>> received_messages;
+    auto on_message = [&](auto envelope) {
+        received_messages.emplace_back(envelope.message.begin(), envelope.message.end());
+    };
+    if (comm.rank() == 0) {
+        queue.resize_receive_buffers(4 * SLICE_SIZE, on_message);
+        for (int receiver = 0; receiver < comm.size_signed(); receiver++) {
+            while (!queue.post_message(std::vector<int>(2 * SLICE_SIZE, receiver), receiver).has_value()) {
+                queue.poll(on_message);
+            }
+        }
+    }
+    while (!queue.terminate(on_message)) {
+    }
+
+    ASSERT_EQ(received_messages.size(), 1);
+    EXPECT_THAT(received_messages.front(), SizeIs(2 * SLICE_SIZE));
+    EXPECT_THAT(received_messages.front(), Each(Eq(comm.rank_signed())));
+}
+
+/// With single_round or nbx termination detection, a rank may not resize its receive buffers on its own, as the other
+/// ranks would not expect its buffer size announcements. No rank falls back to double counting, so nbx still detects
+/// the termination by a single barrier.
+TEST(MessageQueueTest, one_round_termination_refuses_resize) {
+    using namespace ::testing;
+    kamping::Communicator<> comm;
+    for (auto termination_detection :
+         {briefkasten::TerminationDetection::single_round, briefkasten::TerminationDetection::nbx}) {
+        // all queues use the same tags, so the queue of the previous test must be gone on all ranks
+        comm.barrier();
+
+        briefkasten::MessageQueue<int> queue(comm.mpi_communicator(), NUM_REQUEST_SLOTS, SLICE_SIZE);
+        queue.synchronous_mode();
+        queue.set_termination_detection(termination_detection);
+        std::size_t num_received = 0;
+        auto on_message = [&](auto envelope) {
+            EXPECT_THAT(std::vector<int>(envelope.message.begin(), envelope.message.end()),
+                        ElementsAre(envelope.receiver));
+            num_received++;
+        };
+        if (comm.rank() == 0) {
+            EXPECT_THROW(queue.resize_receive_buffers(4 * SLICE_SIZE, on_message), std::runtime_error);
+        }
+        for (int receiver = 0; receiver < comm.size_signed(); receiver++) {
+            while (!queue.post_message(std::vector<int>{receiver}, receiver).has_value()) {
+                queue.poll(on_message);
+            }
+        }
+        while (!queue.terminate(on_message)) {
+        }
+
+        EXPECT_EQ(num_received, comm.size());
+        if (termination_detection == briefkasten::TerminationDetection::nbx) {
+            EXPECT_EQ(queue.num_termination_rounds(), 1);
+        }
+    }
+}
+
+/// The request pool grows below the free slots and shrinks down to its highest active slot.
+TEST(RequestPoolTest, resize) {
+    briefkasten::internal::RequestPool pool(2);
+    EXPECT_EQ(pool.resize(4), 4);
+    EXPECT_EQ(pool.inactive_requests(), 4);
+    std::vector<int> acquired;
+    int value = 0;
+    for (std::size_t i = 0; i < 4; i++) {
+        auto slot = pool.get_some_inactive_request();
+        ASSERT_TRUE(slot.has_value());
+        acquired.push_back(slot->first);
+        if (slot->first == 3) {
+            // keep the highest slot busy with a receive from ourselves, all others are released right away
+            MPI_Irecv(&value, 1, MPI_INT, 0, 0, MPI_COMM_SELF, &slot->second);
+        }
+    }
+    // the old slots are handed out before the new ones
+    EXPECT_EQ(acquired, (std::vector<int>{0, 1, 2, 3}));
+    EXPECT_FALSE(pool.get_some_inactive_request().has_value());
+
+    for (int index : {0, 1, 2}) {
+        pool.release_completed(index);
+    }
+    EXPECT_EQ(pool.resize(1), 4);
+    EXPECT_EQ(pool.active_requests(), 1);
+
+    int sent_value = 42;
+    MPI_Send(&sent_value, 1, MPI_INT, 0, 0, MPI_COMM_SELF);
+    std::vector<int> completed;
+    while (completed.empty()) {
+        pool.test_some([&](int index) { completed.push_back(index); });
+    }
+    EXPECT_EQ(completed, std::vector<int>{3});
+    EXPECT_EQ(value, sent_value);
+    EXPECT_EQ(pool.resize(1), 1);
+    EXPECT_EQ(pool.inactive_requests(), 1);
+    auto slot = pool.get_some_inactive_request();
+    ASSERT_TRUE(slot.has_value());
+    EXPECT_EQ(slot->first, 0);
+
+    // grow again while a slot is in use
+    EXPECT_EQ(pool.resize(3), 3);
+    EXPECT_EQ(pool.active_requests(), 1);
+    EXPECT_EQ(pool.inactive_requests(), 2);
+}
@@ -1,9 +1,12 @@
 #include <gtest/gtest.h>
+#include <kamping/collectives/allreduce.hpp>
 #include <kamping/collectives/barrier.hpp>
 #include <kamping/communicator.hpp>
 
 #include <deque>
+#include <functional>
 #include <random>
+#include <utility>
 #include <vector>
 
 #include "briefkasten/aggregators.hpp"
@@ -14,6 +17,83 @@
 constexpr std::size_t INITIAL_TASKS = 1000;
 
 // NOLINTBEGIN(*-magic-numbers)
+namespace {
+
+/// Each rank generates a fixed number of tasks, consisting of integer ranges:
+/// the first value is the time-to-live, the second value is the number of hops, followed by the list of ranks this
+/// task has been forwarded to. For each task, each rank draws a random branching factor r between 1 and 4, appends
+/// its rank to the task and forwards it to r random ranks. When the time-to-live reaches zero, no new tasks are
+/// spawned.
+///
+/// Once a rank has no tasks left, it calls \p try_terminate with the message handler and the tasks, until it returns
+/// true.
+template <typename Queue>
+void workloop(Queue& queue, auto&& try_terminate) {
+    namespace kmp = kamping::params;
+    kamping::Communicator<> comm;
+    std::deque<std::vector<int>> tasks;
+    std::default_random_engine generator{static_cast<std::default_random_engine::result_type>(comm.rank_signed())};
+    std::uniform_int_distribution<int> distribution(1, 4);
+    std::uniform_int_distribution<int> ttl_distribution(5, 10);
+    std::uniform_int_distribution<int> rank_distribution(0, comm.size_signed() - 1);
+    // Generate initial tasks
+    for (std::size_t i = 0; i < INITIAL_TASKS; ++i) {
+        std::vector<int> task{ttl_distribution(generator), 0};
+        tasks.push_back(std::move(task));
+    }
+    std::size_t num_sent = 0;
+    std::size_t num_received = 0;
+    auto on_message = [&](auto envelope) {
+        num_received++;
+        auto task = std::move(envelope.message);
+        tasks.push_back(std::vector(task.begin(), task.end()));
+    };
+    do {  // NOLINT(*-avoid-do-while)
+        while (!tasks.empty()) {
+            auto task = std::vector(tasks.front().begin(), tasks.front().end());
+            tasks.pop_front();
+            int ttl = task.at(0);
+            if (ttl > 0) {
+                task[0]--;                           // Decrease time-to-live
+                task[1]++;                           // count hops
+                task.push_back(comm.rank_signed());  // Append rank to task
+                int branching_factor = distribution(generator);
+                for (int i = 0; i < branching_factor; ++i) {
+                    briefkasten::PEID receiver = rank_distribution(generator);
+                    queue.post_message_blocking(std::ranges::ref_view(task), receiver, on_message);
+                    num_sent++;
+                }
+            } else {
+                // task is done, check if num hops matches trace.
+                EXPECT_EQ(task[1], task.size() - 2);
+            }
+            queue.poll_throttled(on_message);
+        }
+    } while (!try_terminate(on_message, std::as_const(tasks)));
+
+    // no task may be left behind
+    EXPECT_TRUE(tasks.empty());
+    auto total_sent = comm.allreduce_single(kmp::send_buf(num_sent), kmp::op(std::plus<>{}));
+    auto total_received = comm.allreduce_single(kmp::send_buf(num_received), kmp::op(std::plus<>{}));
+    EXPECT_EQ(total_sent, total_received);
+    comm.barrier();
+}
+
+template <typename Queue>
+void workloop(Queue& queue) {
+    workloop(queue, [&](auto& on_message, auto const& /* tasks */) { return queue.terminate(on_message); });
+}
+
+/// @return a queue for the workloop configured by \p conf, the sentinels separate the tasks in a buffer
+auto build_queue(briefkasten::Config const& conf = {}) {
+    return briefkasten::BufferedMessageQueueBuilder<int>(conf)
+        .with_merger(briefkasten::aggregation::SentinelMerger<int>(-1))
+        .with_splitter(briefkasten::aggregation::SentinelSplitter<int>(-1))
+        .build();
+}
+
+}  // namespace
+
 TEST(BufferedQueueTest, workloop) {
     // each rank generates a fixed number of tasks, consisting of integer ranges:
     // the first value is the time-to-live, the second value is the number of hops, followed by the list of ranks this
@@ -66,6 +146,25 @@ TEST(BufferedQueueTest, workloop) {
     comm.barrier();
 }
 
+TEST(BufferedQueueTest, workloop_single_round_termination) {
+    // termination is detected by single counting rounds, while the message handlers keep spawning tasks until the
+    // very end
+    briefkasten::Config conf;
+    conf.termination_detection = briefkasten::TerminationDetection::single_round;
+    auto queue = build_queue(conf);
+    workloop(queue);
+}
+
+TEST(BufferedQueueTest, workloop_termination_steps) {
+    // termination is detected step by step, so that the loop stays in control
+    auto queue = build_queue();
+    workloop(queue, [&](auto& on_message, auto const& tasks) {
+        auto step = queue.try_terminate_step(on_message);
+        EXPECT_TRUE(step != briefkasten::TerminationStep::reactivated || !tasks.empty());
+        return step == briefkasten::TerminationStep::terminated;
+    });
+}
+
 TEST(BufferedQueueTest, workloop_indirect) {
     // each rank generates a fixed number of tasks, consisting of integer ranges:
     // the first value is the time-to-live, the second value is the number of hops, followed by the list of ranks this